@@ -0,0 +1,362 @@
+#pragma once
+
+#include "partitioner.hpp"
+#include "pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace threadpool11 {
+
+/**
+ * Ranges of up to this many elements are processed sequentially by the algorithms below and
+ * larger ones are not cut into works of fewer elements, unless they are given another grain.
+ */
+constexpr std::size_t default_grain = 4096;
+
+namespace detail {
+
+template <class Iterator>
+typename std::iterator_traits<Iterator>::reference at(Iterator it, std::size_t i) {
+  return it[static_cast<typename std::iterator_traits<Iterator>::difference_type>(i)];
+}
+
+template <class Iterator>
+Iterator nth(Iterator it, std::size_t n) {
+  return it + static_cast<typename std::iterator_traits<Iterator>::difference_type>(n);
+}
+
+/**
+ * Whether n elements are not worth spreading over the workers of the pool.
+ */
+inline bool run_sequentially(const pool& p, std::size_t n, std::size_t grain) {
+  return n <= grain || p.get_worker_count() < 2;
+}
+
+/**
+ * The number of blocks n elements are cut into, a few per worker so that uneven blocks
+ * even out but none of them shorter than grain.
+ */
+inline std::size_t block_count(const pool& p, std::size_t n, std::size_t grain) {
+  return std::max<std::size_t>(1, std::min((n + grain - 1) / grain, 4 * p.get_worker_count()));
+}
+
+/**
+ * Uninitialized storage for n elements, the elements are constructed and destroyed by the user.
+ */
+template <class T>
+class raw_buffer {
+public:
+  explicit raw_buffer(std::size_t n)
+      : data_{allocator_.allocate(n)}
+      , size_{n} {
+  }
+
+  ~raw_buffer() { allocator_.deallocate(data_, size_); }
+
+  raw_buffer(const raw_buffer&) = delete;
+  raw_buffer& operator=(const raw_buffer&) = delete;
+
+  T* data() const { return data_; }
+
+private:
+  std::allocator<T> allocator_;
+  T* const data_;
+  const std::size_t size_;
+};
+
+template <class T>
+void destroy_range(T* first, T* last) {
+  for (; first != last; ++first) {
+    first->~T();
+  }
+}
+
+/**
+ * Sorts n > 1 elements by moving them into buckets split by splitters picked from a sample,
+ * then sorting the buckets on their own.
+ */
+template <class RandomIt, class Compare>
+void sample_sort(pool& p, RandomIt first, std::size_t n, Compare& comp, std::size_t grain) {
+  using value_type = typename std::iterator_traits<RandomIt>::value_type;
+
+  // bucket numbers are kept in 16 bits
+  const std::size_t buckets = std::min<std::size_t>(block_count(p, n, grain), std::size_t{1} << 16);
+  const std::size_t block_size = (n + buckets - 1) / buckets;
+  const std::size_t blocks = (n + block_size - 1) / block_size;
+
+  // splitters refer to the elements by index, the elements may not be copyable
+  constexpr std::size_t oversampling = 32;
+  std::vector<std::size_t> sample(buckets * oversampling);
+  std::uint64_t rng = 88172645463325252u;
+  for (auto& i : sample) {
+    // xorshift64
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    i = static_cast<std::size_t>(rng % n);
+  }
+  std::sort(sample.begin(), sample.end(),
+            [&](std::size_t a, std::size_t b) { return comp(at(first, a), at(first, b)); });
+
+  std::vector<std::size_t> splitters(buckets - 1);
+  for (std::size_t i = 0; i < splitters.size(); ++i) {
+    splitters[i] = sample[(i + 1) * oversampling];
+  }
+
+  // every block counts its elements per bucket and remembers their buckets for the scatter
+  std::unique_ptr<std::uint16_t[]> bucket_of{new std::uint16_t[n]};
+  std::vector<std::size_t> offsets(blocks * buckets, 0);
+  p.parallel_for(std::size_t{0}, blocks,
+                 [&](std::size_t block) {
+                   std::size_t* const counts = &offsets[block * buckets];
+                   const std::size_t hi = std::min(n, (block + 1) * block_size);
+                   for (std::size_t i = block * block_size; i < hi; ++i) {
+                     const auto bucket =
+                         std::upper_bound(splitters.begin(), splitters.end(), i, [&](std::size_t a, std::size_t b) {
+                           return comp(at(first, a), at(first, b));
+                         }) -
+                         splitters.begin();
+                     bucket_of[i] = static_cast<std::uint16_t>(bucket);
+                     ++counts[bucket];
+                   }
+                 },
+                 dynamic_partitioner(1));
+
+  // the counts become where each block writes to in each bucket
+  std::vector<std::size_t> bucket_begin(buckets + 1);
+  std::size_t sum = 0;
+  for (std::size_t bucket = 0; bucket < buckets; ++bucket) {
+    bucket_begin[bucket] = sum;
+    for (std::size_t block = 0; block < blocks; ++block) {
+      const std::size_t count = offsets[block * buckets + bucket];
+      offsets[block * buckets + bucket] = sum;
+      sum += count;
+    }
+  }
+  bucket_begin[buckets] = n;
+
+  raw_buffer<value_type> buffer(n);
+  value_type* const data = buffer.data();
+
+  p.parallel_for(std::size_t{0}, blocks,
+                 [&](std::size_t block) {
+                   std::size_t* const next = &offsets[block * buckets];
+                   const std::size_t hi = std::min(n, (block + 1) * block_size);
+                   for (std::size_t i = block * block_size; i < hi; ++i) {
+                     new (data + next[bucket_of[i]]++) value_type(std::move(at(first, i)));
+                   }
+                 },
+                 dynamic_partitioner(1));
+
+  // each bucket is left in the buffer only as long as it is sorted
+  p.parallel_for(std::size_t{0}, buckets,
+                 [&](std::size_t bucket) {
+                   value_type* const lo = data + bucket_begin[bucket];
+                   value_type* const hi = data + bucket_begin[bucket + 1];
+                   try {
+                     std::sort(lo, hi, comp);
+                     std::move(lo, hi, nth(first, bucket_begin[bucket]));
+                   } catch (...) {
+                     destroy_range(lo, hi);
+                     throw;
+                   }
+                   destroy_range(lo, hi);
+                 },
+                 dynamic_partitioner(1));
+}
+
+}
+
+/**
+ * \brief parallel_transform Same as std::transform(first, last, d_first, op) with the elements spread over the
+ * workers of p.
+ *
+ * op is called from several threads at once. Workers take the elements in chunks of grain.
+ *
+ * \return The end of the output range.
+ */
+template <class InputIt, class OutputIt, class UnaryOperation>
+OutputIt parallel_transform(pool& p, InputIt first, InputIt last, OutputIt d_first, UnaryOperation op,
+                            std::size_t grain = default_grain) {
+  const auto n = static_cast<std::size_t>(std::distance(first, last));
+  grain = std::max<std::size_t>(1, grain);
+  if (detail::run_sequentially(p, n, grain)) {
+    return std::transform(first, last, d_first, op);
+  }
+
+  p.parallel_for(std::size_t{0}, n, [&](std::size_t i) { detail::at(d_first, i) = op(detail::at(first, i)); },
+                 dynamic_partitioner(grain));
+
+  return detail::nth(d_first, n);
+}
+
+/**
+ * \brief parallel_count_if Same as std::count_if(first, last, pred) with the elements spread over the workers of p.
+ *
+ * pred is called from several threads at once. Workers take the elements in chunks of grain.
+ */
+template <class InputIt, class UnaryPredicate>
+typename std::iterator_traits<InputIt>::difference_type parallel_count_if(pool& p, InputIt first, InputIt last,
+                                                                          UnaryPredicate pred,
+                                                                          std::size_t grain = default_grain) {
+  const auto n = static_cast<std::size_t>(std::distance(first, last));
+  grain = std::max<std::size_t>(1, grain);
+  if (detail::run_sequentially(p, n, grain)) {
+    return std::count_if(first, last, pred);
+  }
+
+  const std::size_t count = p.parallel_reduce(
+      std::size_t{0}, n, std::size_t{0},
+      [&](std::size_t i) -> std::size_t { return pred(detail::at(first, i)) ? 1 : 0; }, std::plus<std::size_t>(),
+      dynamic_partitioner(grain));
+
+  return static_cast<typename std::iterator_traits<InputIt>::difference_type>(count);
+}
+
+/**
+ * \brief parallel_find_if Same as std::find_if(first, last, pred) with the elements spread over the workers of p.
+ *
+ * The range is searched in blocks of grain elements handed out in order. Once a match is found,
+ * the blocks after it are skipped and the ones being searched stop at it, so pred is called on a
+ * few elements after the first match at most. pred is called from several threads at once.
+ *
+ * \return The first element pred returns true for, last if there is none.
+ */
+template <class InputIt, class UnaryPredicate>
+InputIt parallel_find_if(pool& p, InputIt first, InputIt last, UnaryPredicate pred,
+                         std::size_t grain = default_grain) {
+  const auto n = static_cast<std::size_t>(std::distance(first, last));
+  grain = std::max<std::size_t>(1, grain);
+  if (detail::run_sequentially(p, n, grain)) {
+    return std::find_if(first, last, pred);
+  }
+
+  std::atomic<std::size_t> found{n};
+  p.parallel_for(std::size_t{0}, (n + grain - 1) / grain,
+                 [&](std::size_t block) {
+                   const std::size_t hi = std::min(n, (block + 1) * grain);
+                   for (std::size_t i = block * grain; i < hi && i < found.load(std::memory_order_relaxed); ++i) {
+                     if (pred(detail::at(first, i))) {
+                       std::size_t current = found.load(std::memory_order_relaxed);
+                       while (i < current && !found.compare_exchange_weak(current, i, std::memory_order_relaxed)) {
+                       }
+                       return;
+                     }
+                   }
+                 },
+                 dynamic_partitioner(1));
+
+  return detail::nth(first, found.load(std::memory_order_relaxed));
+}
+
+/**
+ * \brief parallel_inclusive_scan Same as std::partial_sum(first, last, d_first, op) with the elements spread over
+ * the workers of p.
+ *
+ * The range is cut into a few blocks per worker, none shorter than grain. The blocks are
+ * summed in parallel, then scanned in parallel starting from the sum of the blocks before them.
+ * So op is called about twice per element and has to be associative. d_first may be first.
+ *
+ * \return The end of the output range.
+ */
+template <class InputIt, class OutputIt, class BinaryOperation>
+OutputIt parallel_inclusive_scan(pool& p, InputIt first, InputIt last, OutputIt d_first, BinaryOperation op,
+                                 std::size_t grain = default_grain) {
+  using value_type = typename std::iterator_traits<InputIt>::value_type;
+
+  const auto n = static_cast<std::size_t>(std::distance(first, last));
+  grain = std::max<std::size_t>(1, grain);
+  const std::size_t blocks = detail::block_count(p, n, grain);
+  if (detail::run_sequentially(p, n, grain) || blocks < 2) {
+    return std::partial_sum(first, last, d_first, op);
+  }
+  const std::size_t block_size = (n + blocks - 1) / blocks;
+  const std::size_t used_blocks = (n + block_size - 1) / block_size;
+
+  // the sums of every block but the last one
+  std::vector<value_type> sums(used_blocks - 1, *first);
+  p.parallel_for(std::size_t{0}, used_blocks - 1,
+                 [&](std::size_t block) {
+                   const std::size_t lo = block * block_size;
+                   value_type sum = detail::at(first, lo);
+                   for (std::size_t i = lo + 1; i < lo + block_size; ++i) {
+                     sum = op(std::move(sum), detail::at(first, i));
+                   }
+                   sums[block] = std::move(sum);
+                 },
+                 dynamic_partitioner(1));
+
+  for (std::size_t block = 1; block < sums.size(); ++block) {
+    sums[block] = op(sums[block - 1], sums[block]);
+  }
+
+  p.parallel_for(std::size_t{0}, used_blocks,
+                 [&](std::size_t block) {
+                   const std::size_t lo = block * block_size;
+                   const std::size_t hi = std::min(n, lo + block_size);
+                   value_type sum = block == 0 ? value_type(detail::at(first, lo))
+                                               : op(sums[block - 1], detail::at(first, lo));
+                   detail::at(d_first, lo) = sum;
+                   for (std::size_t i = lo + 1; i < hi; ++i) {
+                     sum = op(std::move(sum), detail::at(first, i));
+                     detail::at(d_first, i) = sum;
+                   }
+                 },
+                 dynamic_partitioner(1));
+
+  return detail::nth(d_first, n);
+}
+
+/**
+ * Same as parallel_inclusive_scan(pool&, InputIt, InputIt, OutputIt, BinaryOperation, std::size_t) with a sum.
+ */
+template <class InputIt, class OutputIt>
+OutputIt parallel_inclusive_scan(pool& p, InputIt first, InputIt last, OutputIt d_first) {
+  return parallel_inclusive_scan(p, first, last, d_first,
+                                 std::plus<typename std::iterator_traits<InputIt>::value_type>());
+}
+
+/**
+ * \brief parallel_sort Same as std::sort(first, last, comp) with the elements spread over the workers of p.
+ *
+ * A sample sort: the elements are moved into a few buckets per worker, split by splitters
+ * picked from a random sample, then the buckets are sorted in parallel and moved back. It
+ * needs a buffer of as many elements. Ranges of up to grain elements are sorted right away,
+ * so are types whose move constructor may throw. Buckets of equal elements are not split
+ * further, so ranges with few distinct values scale worse. comp is called from several
+ * threads at once.
+ */
+template <class RandomIt, class Compare>
+void parallel_sort(pool& p, RandomIt first, RandomIt last, Compare comp, std::size_t grain = default_grain) {
+  using value_type = typename std::iterator_traits<RandomIt>::value_type;
+
+  const auto n = static_cast<std::size_t>(std::distance(first, last));
+  grain = std::max<std::size_t>(1, grain);
+  if (detail::run_sequentially(p, n, grain) || !std::is_nothrow_move_constructible<value_type>::value) {
+    std::sort(first, last, comp);
+    return;
+  }
+
+  detail::sample_sort(p, first, n, comp, grain);
+}
+
+/**
+ * Same as parallel_sort(pool&, RandomIt, RandomIt, Compare, std::size_t) with operator<.
+ */
+template <class RandomIt>
+void parallel_sort(pool& p, RandomIt first, RandomIt last) {
+  parallel_sort(p, first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+}
+
+}
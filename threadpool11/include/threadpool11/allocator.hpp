@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+
+#if defined(WIN32) && defined(threadpool11_DLL)
+#ifdef threadpool11_EXPORTING
+#define threadpool11_EXPORT __declspec(dllexport)
+#else
+#define threadpool11_EXPORT __declspec(dllimport)
+#endif
+#else
+#define threadpool11_EXPORT
+#endif
+
+namespace threadpool11 {
+
+/**
+ * \brief Free-list allocator for the small objects the pool creates per work (works, future states).
+ *
+ * Blocks are rounded up to a size class and cached per thread. Caches trade
+ * blocks in batches through a process-wide depot, so the usual pattern of one
+ * thread allocating and another one freeing stays off the global allocator.
+ * Blocks bigger than max_size go to ::operator new.
+ *
+ * The depot is process-wide rather than per pool since futures may outlive
+ * the pool that created them.
+ *
+ * Properties: thread-safe.
+ */
+class small_object_allocator {
+public:
+  static constexpr std::size_t max_size = 256;
+
+public:
+  threadpool11_EXPORT static void* allocate(std::size_t size);
+  threadpool11_EXPORT static void deallocate(void* ptr, std::size_t size);
+};
+
+}
+
+#undef threadpool11_EXPORT
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "allocator.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <utility>
+
+namespace threadpool11 {
+
+/**
+ * \brief Stored in the future of a work that was cancelled before it started, see pool::post_work.
+ */
+class operation_cancelled : public std::exception {
+public:
+  const char* what() const noexcept override { return "threadpool11: operation cancelled"; }
+};
+
+/**
+ * \return An exception_ptr to operation_cancelled, made once and shared so that dropping a work does not throw.
+ */
+inline std::exception_ptr cancelled_exception() {
+  static const std::exception_ptr exception = std::make_exception_ptr(operation_cancelled());
+  return exception;
+}
+
+class cancellation_source;
+
+/**
+ * \brief Tells whether the cancellation_source it came from has been cancelled.
+ *
+ * Tokens are cheap to copy, a token is a pointer to the state it shares with its
+ * source. A default constructed token is never cancelled.
+ *
+ * Properties: thread-safe.
+ */
+class cancellation_token {
+public:
+  cancellation_token() noexcept
+      : state_{nullptr} {
+  }
+
+  cancellation_token(const cancellation_token& other) noexcept
+      : state_{other.state_} {
+    add_ref();
+  }
+
+  cancellation_token(cancellation_token&& other) noexcept
+      : state_{other.state_} {
+    other.state_ = nullptr;
+  }
+
+  cancellation_token& operator=(cancellation_token other) noexcept {
+    std::swap(state_, other.state_);
+    return *this;
+  }
+
+  ~cancellation_token() { release(); }
+
+  bool is_cancelled() const noexcept {
+    return state_ != nullptr && state_->cancelled.load(std::memory_order_acquire);
+  }
+
+  /**
+   * \return false for a default constructed token.
+   */
+  bool can_be_cancelled() const noexcept { return state_ != nullptr; }
+
+  /**
+   * \brief throw_if_cancelled For long running works to poll the token with.
+   *
+   * \throws operation_cancelled If the token is cancelled.
+   */
+  void throw_if_cancelled() const {
+    if (is_cancelled()) {
+      throw operation_cancelled();
+    }
+  }
+
+private:
+  friend class cancellation_source;
+
+  struct state {
+    state()
+        : cancelled{false}
+        , refs{1} {
+    }
+
+    static void* operator new(std::size_t size) { return small_object_allocator::allocate(size); }
+    static void operator delete(void* ptr, std::size_t size) { small_object_allocator::deallocate(ptr, size); }
+
+    std::atomic<bool> cancelled;
+    std::atomic<std::uint32_t> refs;
+  };
+
+private:
+  explicit cancellation_token(state* state) noexcept
+      : state_{state} {
+  }
+
+  void add_ref() noexcept {
+    if (state_ != nullptr) {
+      state_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  void release() noexcept {
+    if (state_ != nullptr && state_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete state_;
+    }
+  }
+
+private:
+  state* state_;
+};
+
+/**
+ * \brief Cancels the works its tokens were posted with.
+ *
+ *   cancellation_source source;
+ *   auto future = pool.post_work(source.token(), []() { ... });
+ *   source.cancel();
+ *
+ * Cancelling is cooperative: works that have not started yet are dropped by the
+ * worker that picks them up, works that are running keep running unless they poll
+ * their token. Copies of a source share the same state.
+ *
+ * Properties: thread-safe.
+ */
+class cancellation_source {
+public:
+  cancellation_source()
+      : token_{new cancellation_token::state} {
+  }
+
+  cancellation_token token() const noexcept { return token_; }
+
+  void cancel() noexcept { token_.state_->cancelled.store(true, std::memory_order_release); }
+
+  bool is_cancelled() const noexcept { return token_.is_cancelled(); }
+
+private:
+  cancellation_token token_;
+};
+
+}
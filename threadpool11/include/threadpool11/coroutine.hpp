@@ -0,0 +1,268 @@
+#pragma once
+
+#include "pool.hpp"
+
+#if defined(threadpool11_COROUTINES)
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace threadpool11 {
+
+/**
+ * \brief Awaitable returned by pool::schedule, resumes the awaiting coroutine on a worker.
+ *
+ * The awaiter lives in the coroutine frame while the coroutine is suspended, and
+ * so does the work that resumes it. Neither can be copied or moved.
+ */
+class schedule_awaiter {
+public:
+  explicit schedule_awaiter(pool& pool)
+      : pool_{pool}
+      , work_{work::type_t::EXTERNAL, resumer{this}} {
+  }
+
+  schedule_awaiter(const schedule_awaiter&) = delete;
+  schedule_awaiter& operator=(const schedule_awaiter&) = delete;
+
+  bool await_ready() const noexcept { return false; }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    handle_ = handle;
+    pool_.push(&work_);
+  }
+
+  void await_resume() const noexcept {}
+
+private:
+  struct resumer {
+    void operator()() const {
+      // the awaiter is gone once the coroutine moves on
+      const std::coroutine_handle<> handle = awaiter->handle_;
+      handle.resume();
+    }
+
+    schedule_awaiter* awaiter;
+  };
+
+private:
+  pool& pool_;
+  std::coroutine_handle<> handle_;
+  work work_;
+};
+
+inline schedule_awaiter pool::schedule() { return schedule_awaiter{*this}; }
+
+template <class T = void>
+class task;
+
+/**
+ * \brief Common part of the promise types of task<T>.
+ *
+ * Coroutine frames come from small_object_allocator like works do.
+ */
+class task_promise_base {
+public:
+  struct final_awaiter {
+    bool await_ready() const noexcept { return false; }
+
+    template <class Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+      const std::coroutine_handle<> continuation = handle.promise().continuation_;
+      return continuation ? continuation : std::noop_coroutine();
+    }
+
+    void await_resume() const noexcept {}
+  };
+
+public:
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  final_awaiter final_suspend() const noexcept { return {}; }
+
+  void unhandled_exception() noexcept { exception_ = std::current_exception(); }
+
+  static void* operator new(std::size_t size) { return small_object_allocator::allocate(size); }
+  static void operator delete(void* ptr, std::size_t size) { small_object_allocator::deallocate(ptr, size); }
+
+protected:
+  void rethrow_if_failed() const {
+    if (exception_) {
+      std::rethrow_exception(exception_);
+    }
+  }
+
+private:
+  template <class T>
+  friend class task;
+
+  std::coroutine_handle<> continuation_;
+  std::exception_ptr exception_;
+};
+
+template <class T>
+class task_promise : public task_promise_base {
+public:
+  task<T> get_return_object() noexcept;
+
+  template <class U>
+  void return_value(U&& value) {
+    value_.emplace(std::forward<U>(value));
+  }
+
+  T result() {
+    rethrow_if_failed();
+    return std::move(*value_);
+  }
+
+private:
+  std::optional<T> value_;
+};
+
+template <>
+class task_promise<void> : public task_promise_base {
+public:
+  task<void> get_return_object() noexcept;
+
+  void return_void() const noexcept {}
+
+  void result() const { rethrow_if_failed(); }
+};
+
+/**
+ * \brief A lazily started coroutine producing a T.
+ *
+ * The coroutine starts when the task is awaited and runs on the awaiting thread until
+ * it suspends, e.g. on co_await pool.schedule(). When it finishes, the awaiting coroutine
+ * is resumed right away on the thread that finished it, so a chain of tasks keeps running
+ * on the pool without any thread blocking for it. Exceptions are rethrown to the awaiter.
+ *
+ * A task must be awaited at most once. See sync_wait for waiting from outside a coroutine.
+ */
+template <class T>
+class task {
+public:
+  using promise_type = task_promise<T>;
+
+  class awaiter {
+  public:
+    explicit awaiter(std::coroutine_handle<promise_type> handle)
+        : handle_{handle} {
+    }
+
+    bool await_ready() const noexcept { return handle_.done(); }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+      handle_.promise().continuation_ = continuation;
+      return handle_;
+    }
+
+    T await_resume() { return handle_.promise().result(); }
+
+  private:
+    std::coroutine_handle<promise_type> handle_;
+  };
+
+public:
+  task(task&& other) noexcept
+      : handle_{std::exchange(other.handle_, nullptr)} {
+  }
+
+  task& operator=(task&& other) noexcept {
+    if (this != &other) {
+      reset();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+
+  ~task() { reset(); }
+
+  task(const task&) = delete;
+  task& operator=(const task&) = delete;
+
+  awaiter operator co_await() const noexcept { return awaiter{handle_}; }
+
+  /**
+   * \return Whether the task refers to a coroutine, i.e. it has not been moved from.
+   */
+  bool valid() const noexcept { return static_cast<bool>(handle_); }
+
+private:
+  friend class task_promise<T>;
+
+  explicit task(std::coroutine_handle<promise_type> handle)
+      : handle_{handle} {
+  }
+
+  void reset() {
+    if (handle_) {
+      handle_.destroy();
+      handle_ = nullptr;
+    }
+  }
+
+private:
+  std::coroutine_handle<promise_type> handle_;
+};
+
+template <class T>
+task<T> task_promise<T>::get_return_object() noexcept {
+  return task<T>{std::coroutine_handle<task_promise<T>>::from_promise(*this)};
+}
+
+inline task<void> task_promise<void>::get_return_object() noexcept {
+  return task<void>{std::coroutine_handle<task_promise<void>>::from_promise(*this)};
+}
+
+/**
+ * Coroutine that starts right away and frees itself when done, only used by sync_wait.
+ */
+class sync_wait_task {
+public:
+  struct promise_type {
+    sync_wait_task get_return_object() const noexcept { return {}; }
+    std::suspend_never initial_suspend() const noexcept { return {}; }
+    std::suspend_never final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    void unhandled_exception() const noexcept { std::terminate(); }
+  };
+};
+
+template <class T>
+sync_wait_task sync_wait_start(task<T> awaited, promise<T> promise) {
+  try {
+    if constexpr (std::is_void<T>::value) {
+      co_await awaited;
+      promise.set_value();
+    } else {
+      promise.set_value(co_await awaited);
+    }
+  } catch (...) {
+    promise.set_exception(std::current_exception());
+  }
+}
+
+/**
+ * \brief sync_wait Runs task and waits for its result.
+ *
+ * The calling thread blocks, or runs other works of its pool meanwhile if it is a worker,
+ * see future::get.
+ *
+ * \return The result of task, its exception is rethrown.
+ */
+template <class T>
+T sync_wait(task<T> awaited) {
+  promise<T> promise;
+  auto future = promise.get_future();
+  sync_wait_start(std::move(awaited), std::move(promise));
+  return future.get();
+}
+
+}
+
+#endif
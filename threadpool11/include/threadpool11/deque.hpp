@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace threadpool11 {
+
+/**
+ * \brief A Chase-Lev work-stealing deque.
+ *
+ * The owning thread pushes and pops at the bottom (LIFO) while any other
+ * thread may steal from the top (FIFO). The ring buffer grows when full; old
+ * buffers are kept alive until the deque is destroyed since a thief might
+ * still be reading from them.
+ *
+ * T has to be trivially copyable, it is used with pointers in the pool.
+ *
+ * Properties: push/pop owner-only, steal thread-safe.
+ */
+template <class T>
+class work_stealing_deque {
+public:
+  using size_type = std::size_t;
+
+public:
+  explicit work_stealing_deque(size_type log_capacity = 8)
+      : top_{0}
+      , bottom_{0}
+      , array_{new array(log_capacity)} {
+  }
+
+  ~work_stealing_deque() { delete array_.load(std::memory_order_relaxed); }
+
+  work_stealing_deque(const work_stealing_deque&) = delete;
+  work_stealing_deque& operator=(const work_stealing_deque&) = delete;
+
+  void push(T item) {
+    const std::int64_t b = bottom_.load(std::memory_order_relaxed);
+    const std::int64_t t = top_.load(std::memory_order_acquire);
+    array* a = array_.load(std::memory_order_relaxed);
+
+    if (b - t > static_cast<std::int64_t>(a->capacity()) - 1) {
+      a = grow(a, b, t);
+    }
+
+    a->put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  bool pop(T& item) {
+    const std::int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    array* const a = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t t = top_.load(std::memory_order_relaxed);
+
+    if (t > b) {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+
+    item = a->get(b);
+    if (t == b) {
+      // last item, race against the thieves for it
+      const bool won =
+          top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+
+    return true;
+  }
+
+  bool steal(T& item) {
+    std::int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const std::int64_t b = bottom_.load(std::memory_order_acquire);
+
+    if (t >= b) {
+      return false;
+    }
+
+    array* const a = array_.load(std::memory_order_acquire);
+    item = a->get(t);
+    return top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+  }
+
+  /**
+   * \return Approximate number of items in the deque.
+   */
+  size_type size() const {
+    const std::int64_t b = bottom_.load(std::memory_order_relaxed);
+    const std::int64_t t = top_.load(std::memory_order_relaxed);
+    return b > t ? static_cast<size_type>(b - t) : 0;
+  }
+
+  bool empty() const { return size() == 0; }
+
+private:
+  class array {
+  public:
+    explicit array(size_type log_capacity)
+        : mask_{(size_type{1} << log_capacity) - 1}
+        , log_capacity_{log_capacity}
+        , items_{new std::atomic<T>[size_type{1} << log_capacity]} {
+    }
+
+    size_type capacity() const { return mask_ + 1; }
+    size_type log_capacity() const { return log_capacity_; }
+
+    T get(std::int64_t i) const { return items_[static_cast<size_type>(i) & mask_].load(std::memory_order_relaxed); }
+    void put(std::int64_t i, T item) { items_[static_cast<size_type>(i) & mask_].store(item, std::memory_order_relaxed); }
+
+  private:
+    const size_type mask_;
+    const size_type log_capacity_;
+    const std::unique_ptr<std::atomic<T>[]> items_;
+  };
+
+private:
+  array* grow(array* old, std::int64_t b, std::int64_t t) {
+    array* const a = new array(old->log_capacity() + 1);
+    for (std::int64_t i = t; i < b; ++i) {
+      a->put(i, old->get(i));
+    }
+    retired_.emplace_back(old);
+    array_.store(a, std::memory_order_release);
+    return a;
+  }
+
+private:
+  // thieves write top_, the owner bottom_. Padded since new does not honor alignas(64) in C++11,
+  // a whole cache line around each keeps them apart wherever the deque lands.
+  char front_padding_[64];
+  std::atomic<std::int64_t> top_;
+  char middle_padding_[64];
+  std::atomic<std::int64_t> bottom_;
+  std::atomic<array*> array_;
+
+  std::vector<std::unique_ptr<array>> retired_;
+  char back_padding_[64];
+};
+
+}
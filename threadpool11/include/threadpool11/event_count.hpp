@@ -0,0 +1,95 @@
+#pragma once
+
+#include "futex.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+namespace threadpool11 {
+
+/**
+ * \brief Lets threads sleep until a condition they check lock-free may have changed.
+ *
+ * Waiter:
+ *   key = prepare_wait();
+ *   if (condition) { cancel_wait(); ... } else { commit_wait(key); }
+ *
+ * Notifier: makes the condition true, then calls notify().
+ *
+ * notify() only makes a syscall if somebody is between prepare_wait() and the
+ * end of commit_wait(), so notifying an event nobody waits on is a fence and a load.
+ *
+ * Properties: thread-safe.
+ */
+class event_count {
+public:
+  event_count()
+      : epoch_{0}
+      , waiters_{0} {
+  }
+
+  event_count(const event_count&) = delete;
+  event_count& operator=(const event_count&) = delete;
+
+  std::uint32_t prepare_wait() {
+    waiters_.fetch_add(1, std::memory_order_seq_cst);
+    return epoch_.load(std::memory_order_seq_cst);
+  }
+
+  void cancel_wait() { waiters_.fetch_sub(1, std::memory_order_relaxed); }
+
+  void commit_wait(std::uint32_t key) {
+    while (epoch_.load(std::memory_order_acquire) == key) {
+      futex_wait(epoch_, key);
+    }
+    waiters_.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * \brief Same as commit_wait but gives up after timeout.
+   */
+  void commit_wait_for(std::uint32_t key, std::chrono::nanoseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (epoch_.load(std::memory_order_acquire) == key) {
+      const auto now = std::chrono::steady_clock::now();
+      if (now >= deadline) {
+        break;
+      }
+      futex_wait_for(epoch_, key, deadline - now);
+    }
+    waiters_.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * \brief Wakes up at most count waiters.
+   */
+  void notify(std::uint32_t count = 1) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const std::uint32_t waiters = waiters_.load(std::memory_order_relaxed);
+    if (waiters != 0) {
+      epoch_.fetch_add(1, std::memory_order_release);
+      futex_wake(epoch_, count < waiters ? count : waiters);
+    }
+  }
+
+  void notify_all() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_relaxed) != 0) {
+      epoch_.fetch_add(1, std::memory_order_release);
+      futex_wake(epoch_, std::numeric_limits<std::uint32_t>::max());
+    }
+  }
+
+  /**
+   * \return The number of threads that are waiting or about to.
+   */
+  std::uint32_t waiter_count() const { return waiters_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<std::uint32_t> epoch_;
+  std::atomic<std::uint32_t> waiters_;
+};
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#endif
+
+#if defined(WIN32) && defined(threadpool11_DLL)
+#ifdef threadpool11_EXPORTING
+#define threadpool11_EXPORT __declspec(dllexport)
+#else
+#define threadpool11_EXPORT __declspec(dllimport)
+#endif
+#else
+#define threadpool11_EXPORT
+#endif
+
+namespace threadpool11 {
+
+/**
+ * \brief Blocks while word == expected or until woken up by futex_wake.
+ *
+ * Uses the futex syscall on Linux and a hashed table of condition variables
+ * elsewhere. Like the syscall, it may return spuriously, so callers have to
+ * re-check their condition.
+ */
+threadpool11_EXPORT void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t expected);
+
+/**
+ * \brief Same as futex_wait but gives up after timeout.
+ */
+threadpool11_EXPORT void futex_wait_for(std::atomic<std::uint32_t>& word, std::uint32_t expected,
+                                        std::chrono::nanoseconds timeout);
+
+/**
+ * \brief Wakes up to count threads blocked in futex_wait on word.
+ */
+threadpool11_EXPORT void futex_wake(std::atomic<std::uint32_t>& word, std::uint32_t count);
+
+/**
+ * \brief Hints the CPU that the caller is busy waiting.
+ */
+inline void cpu_relax() {
+#if defined(__i386__) || defined(__x86_64__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  asm volatile("yield" ::: "memory");
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+  _mm_pause();
+#endif
+}
+
+}
+
+#undef threadpool11_EXPORT
@@ -0,0 +1,833 @@
+#pragma once
+
+#include "allocator.hpp"
+#include "futex.hpp"
+#include "work.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace threadpool11 {
+
+/**
+ * \brief Thrown on misuse of future and promise, and by futures whose promise was broken.
+ *
+ * Mirrors std::future_error, whose constructor is not accessible before C++17.
+ */
+class future_error : public std::logic_error {
+public:
+  explicit future_error(std::future_errc errc)
+      : std::logic_error{std::make_error_code(errc).message()}
+      , code_{std::make_error_code(errc)} {
+  }
+
+  const std::error_code& code() const noexcept { return code_; }
+
+private:
+  std::error_code code_;
+};
+
+/**
+ * \brief Something a thread can do instead of blocking while it waits for a future.
+ *
+ * Pool workers register themselves as the helper of their thread, so that a
+ * work waiting for the future of another work runs queued works meanwhile
+ * instead of blocking its worker.
+ */
+class wait_helper {
+public:
+  /**
+   * \brief Does a bit of other work.
+   *
+   * \return false if there was nothing to do.
+   */
+  virtual bool help() = 0;
+
+  /**
+   * \return The helper of the calling thread, nullptr if it has none.
+   */
+  static wait_helper*& current() {
+    static thread_local wait_helper* helper = nullptr;
+    return helper;
+  }
+
+protected:
+  ~wait_helper() = default;
+};
+
+template <class T>
+class future;
+
+template <class T>
+class basic_promise;
+
+template <class T>
+class promise;
+
+template <class T>
+class when_all_state;
+
+template <class T>
+class when_any_state;
+
+/**
+ * \brief Shared state of a promise/future pair.
+ *
+ * Completion is signalled through a single atomic status word. Waiters spin
+ * on it for a while and park on it with futex_wait afterwards; the setter only
+ * makes a syscall if somebody is actually parked. A continuation can be
+ * attached instead of waiting, the setter runs it right after publishing the
+ * result. States come from small_object_allocator. A reference result is kept as a
+ * std::reference_wrapper, i.e. a pointer to the referred object.
+ */
+template <class T>
+class future_state {
+public:
+  using value_type = typename std::conditional<
+      std::is_void<T>::value, char,
+      typename std::conditional<std::is_reference<T>::value,
+                                std::reference_wrapper<typename std::remove_reference<T>::type>, T>::type>::type;
+
+  static constexpr unsigned spin_count = 1024;
+  static constexpr std::chrono::microseconds help_park_time{500};
+
+public:
+  future_state()
+      : status_{PENDING}
+      , refs_{1}
+      , retrieved_{false}
+      , continuation_{nullptr} {
+  }
+
+  future_state(const future_state&) = delete;
+  future_state& operator=(const future_state&) = delete;
+
+  bool is_ready() const { return status_.load(std::memory_order_acquire) >= VALUE; }
+
+  void wait() {
+    if (wait_helper* const helper = wait_helper::current()) {
+      help(*helper, std::chrono::steady_clock::time_point::max());
+      return;
+    }
+
+    if (spin()) {
+      return;
+    }
+
+    std::uint32_t status = status_.load(std::memory_order_acquire);
+    while (status < VALUE) {
+      if ((status & WAITING) != 0 ||
+          status_.compare_exchange_weak(status, status | WAITING, std::memory_order_acquire)) {
+        futex_wait(status_, status | WAITING);
+        status = status_.load(std::memory_order_acquire);
+      }
+    }
+  }
+
+  template <class Clock, class Duration>
+  std::future_status wait_until(const std::chrono::time_point<Clock, Duration>& deadline) {
+    if (wait_helper* const helper = wait_helper::current()) {
+      return help(*helper, std::chrono::steady_clock::now() + (deadline - Clock::now()));
+    }
+    return block_until(deadline);
+  }
+
+  template <class... Args>
+  void set_value(Args&&... args) {
+    ::new (&value_) value_type(std::forward<Args>(args)...);
+    publish(VALUE);
+  }
+
+  void set_exception(std::exception_ptr exception) {
+    exception_ = std::move(exception);
+    publish(EXCEPTION);
+  }
+
+  /**
+   * \brief Runs continuation once the state is ready, right away if it already is.
+   *
+   * The continuation runs on the thread that makes the state ready. At most one
+   * continuation can be set.
+   */
+  void set_continuation(std::unique_ptr<work> continuation) {
+    continuation_ = continuation.get();
+
+    std::uint32_t status = status_.load(std::memory_order_acquire);
+    while (status < VALUE) {
+      if (status_.compare_exchange_weak(status, status | CONTINUATION, std::memory_order_acq_rel)) {
+        continuation.release();
+        return;
+      }
+    }
+
+    continuation_ = nullptr;
+    (*continuation)();
+  }
+
+  /**
+   * Rethrows the stored exception if there is one, returns the value otherwise. Must be ready.
+   */
+  value_type& get() {
+    if (status_.load(std::memory_order_acquire) == EXCEPTION) {
+      std::rethrow_exception(exception_);
+    }
+    return *reinterpret_cast<value_type*>(&value_);
+  }
+
+  void add_ref() { refs_.fetch_add(1, std::memory_order_relaxed); }
+
+  void release() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete this;
+    }
+  }
+
+  static void* operator new(std::size_t size) { return small_object_allocator::allocate(size); }
+  static void operator delete(void* ptr, std::size_t size) { small_object_allocator::deallocate(ptr, size); }
+
+private:
+  friend class basic_promise<T>;
+
+  /**
+   * WAITING and CONTINUATION are flags of a pending state, publishing replaces them with VALUE or EXCEPTION.
+   */
+  enum : std::uint32_t {
+    PENDING = 0,
+    WAITING = 1,
+    CONTINUATION = 2,
+    VALUE = 4,
+    EXCEPTION = 8,
+  };
+
+  ~future_state() {
+    if (status_.load(std::memory_order_relaxed) == VALUE) {
+      reinterpret_cast<value_type*>(&value_)->~value_type();
+    }
+  }
+
+  template <class Clock, class Duration>
+  std::future_status block_until(const std::chrono::time_point<Clock, Duration>& deadline) {
+    if (spin()) {
+      return std::future_status::ready;
+    }
+
+    std::uint32_t status = status_.load(std::memory_order_acquire);
+    while (status < VALUE) {
+      const auto now = Clock::now();
+      if (now >= deadline) {
+        return std::future_status::timeout;
+      }
+      if ((status & WAITING) != 0 ||
+          status_.compare_exchange_weak(status, status | WAITING, std::memory_order_acquire)) {
+        futex_wait_for(status_, status | WAITING,
+                       std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now));
+        status = status_.load(std::memory_order_acquire);
+      }
+    }
+
+    return std::future_status::ready;
+  }
+
+  /**
+   * Lets helper run other works until the state is ready. Once there is nothing to run it
+   * blocks for help_park_time at most at a time, works posted meanwhile are picked up after.
+   */
+  std::future_status help(wait_helper& helper, std::chrono::steady_clock::time_point deadline) {
+    unsigned idle_rounds = 0;
+    while (!is_ready()) {
+      if (helper.help()) {
+        idle_rounds = 0;
+        continue;
+      }
+
+      const auto now = std::chrono::steady_clock::now();
+      if (now >= deadline) {
+        return std::future_status::timeout;
+      }
+
+      if (++idle_rounds < spin_count) {
+        cpu_relax();
+      } else {
+        block_until(now + std::min<std::chrono::steady_clock::duration>(deadline - now, help_park_time));
+      }
+    }
+
+    return std::future_status::ready;
+  }
+
+  bool spin() const {
+    for (unsigned i = 0; i < spin_count; ++i) {
+      if (is_ready()) {
+        return true;
+      }
+      cpu_relax();
+    }
+    return false;
+  }
+
+  void publish(std::uint32_t status) {
+    const std::uint32_t old = status_.exchange(status, std::memory_order_acq_rel);
+    if ((old & WAITING) != 0) {
+      futex_wake(status_, std::numeric_limits<std::uint32_t>::max());
+    }
+    if ((old & CONTINUATION) != 0) {
+      const std::unique_ptr<work> continuation{continuation_};
+      continuation_ = nullptr;
+      (*continuation)();
+    }
+  }
+
+private:
+  std::atomic<std::uint32_t> status_;
+  std::atomic<std::uint32_t> refs_;
+  bool retrieved_;
+  std::exception_ptr exception_;
+  work* continuation_;
+  typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type value_;
+};
+
+/**
+ * \brief Common part of future<T> and future<void>.
+ */
+template <class T>
+class basic_future {
+public:
+  basic_future() noexcept
+      : state_{nullptr} {
+  }
+
+  basic_future(basic_future&& other) noexcept
+      : state_{other.state_} {
+    other.state_ = nullptr;
+  }
+
+  basic_future& operator=(basic_future&& other) noexcept {
+    if (this != &other) {
+      reset();
+      state_ = other.state_;
+      other.state_ = nullptr;
+    }
+    return *this;
+  }
+
+  ~basic_future() { reset(); }
+
+  basic_future(const basic_future&) = delete;
+  basic_future& operator=(const basic_future&) = delete;
+
+  /**
+   * \return Whether this future refers to a shared state, i.e. get() has not been called yet.
+   */
+  bool valid() const noexcept { return state_ != nullptr; }
+
+  /**
+   * \return Whether the result is available. Does not block.
+   */
+  bool is_ready() const {
+    check();
+    return state_->is_ready();
+  }
+
+  /**
+   * \brief Blocks until the result is available.
+   *
+   * Spins for a short while before parking the calling thread. On a pool worker it
+   * runs other works of the pool meanwhile instead, see wait_helper, so works can
+   * wait for the works they post without tying up their worker.
+   */
+  void wait() const {
+    check();
+    state_->wait();
+  }
+
+  template <class Rep, class Period>
+  std::future_status wait_for(const std::chrono::duration<Rep, Period>& timeout) const {
+    return wait_until(std::chrono::steady_clock::now() + timeout);
+  }
+
+  template <class Clock, class Duration>
+  std::future_status wait_until(const std::chrono::time_point<Clock, Duration>& deadline) const {
+    check();
+    return state_->wait_until(deadline);
+  }
+
+protected:
+  explicit basic_future(future_state<T>* state)
+      : state_{state} {
+  }
+
+  void check() const {
+    if (state_ == nullptr) {
+      throw future_error(std::future_errc::no_state);
+    }
+  }
+
+  void reset() {
+    if (state_ != nullptr) {
+      state_->release();
+      state_ = nullptr;
+    }
+  }
+
+  template <class U, class Executor, class F>
+  future<U> then_impl(Executor& executor, F&& callable);
+
+protected:
+  template <class U>
+  friend class when_all_state;
+  template <class U>
+  friend class when_any_state;
+
+  future_state<T>* state_;
+};
+
+/**
+ * \brief Calls callable with the result of an antecedent state and fulfills promise with what it returns.
+ *
+ * If the antecedent holds an exception the callable is not called and the exception is
+ * passed on to the promise.
+ */
+template <class T, class F, class U>
+class continuation_work {
+public:
+  template <class G>
+  continuation_work(future_state<T>* antecedent, G&& callable, promise<U> promise)
+      : antecedent_{antecedent}
+      , callable_(std::forward<G>(callable))
+      , promise_{std::move(promise)} {
+  }
+
+  continuation_work(continuation_work&& other) noexcept(std::is_nothrow_move_constructible<F>::value)
+      : antecedent_{other.antecedent_}
+      , callable_(std::move(other.callable_))
+      , promise_{std::move(other.promise_)} {
+    other.antecedent_ = nullptr;
+  }
+
+  ~continuation_work() {
+    if (antecedent_ != nullptr) {
+      antecedent_->release();
+    }
+  }
+
+  continuation_work(const continuation_work&) = delete;
+  continuation_work& operator=(const continuation_work&) = delete;
+
+  void operator()() {
+    try {
+      complete(std::is_void<U>{});
+    } catch (...) {
+      promise_.set_exception(std::current_exception());
+    }
+  }
+
+private:
+  void complete(std::false_type) { promise_.set_value(call(std::is_void<T>{})); }
+
+  void complete(std::true_type) {
+    call(std::is_void<T>{});
+    promise_.set_value();
+  }
+
+  // moves a value out, hands on a reference result as the reference
+  U call(std::false_type) { return callable_(static_cast<T&&>(antecedent_->get())); }
+
+  U call(std::true_type) {
+    antecedent_->get();
+    return callable_();
+  }
+
+private:
+  future_state<T>* antecedent_;
+  F callable_;
+  promise<U> promise_;
+};
+
+/**
+ * \brief Attached to a future_state by future::then, posts the continuation to the executor.
+ */
+template <class Executor, class Continuation>
+class post_continuation_work {
+public:
+  post_continuation_work(Executor& executor, Continuation continuation)
+      : executor_{&executor}
+      , continuation_{std::move(continuation)} {
+  }
+
+  void operator()() { executor_->post_work(std::move(continuation_), Executor::no_future_tag); }
+
+private:
+  Executor* executor_;
+  Continuation continuation_;
+};
+
+/**
+ * \brief The result of a work posted to the pool.
+ *
+ * Behaves like std::future<T> but does not use a mutex or a condition
+ * variable; see future_state.
+ */
+template <class T>
+class future : public basic_future<T> {
+public:
+  future() noexcept = default;
+  future(future&&) noexcept = default;
+  future& operator=(future&&) noexcept = default;
+
+  /**
+   * \brief Waits for the result and returns it. Rethrows if the work threw.
+   *
+   * valid() is false afterwards.
+   */
+  T get() {
+    this->wait();
+    struct releaser {
+      future& self;
+      ~releaser() { self.reset(); }
+    } const release{*this};
+    return std::move(this->state_->get());
+  }
+
+  /**
+   * \brief Calls callable with the result on executor once it is available.
+   *
+   * Nobody blocks in the meantime; whoever makes this future ready posts the
+   * continuation to the executor, e.g. a pool. If this future ends up holding an
+   * exception, callable is skipped and the returned future gets the exception.
+   *
+   * valid() is false afterwards.
+   */
+  template <class Executor, class F,
+            class U = decltype(std::declval<typename std::decay<F>::type&>()(std::declval<T>()))>
+  future<U> then(Executor& executor, F&& callable) {
+    return this->template then_impl<U>(executor, std::forward<F>(callable));
+  }
+
+private:
+  friend class basic_promise<T>;
+
+  explicit future(future_state<T>* state)
+      : basic_future<T>{state} {
+  }
+};
+
+template <>
+class future<void> : public basic_future<void> {
+public:
+  future() noexcept = default;
+  future(future&&) noexcept = default;
+  future& operator=(future&&) noexcept = default;
+
+  void get() {
+    wait();
+    struct releaser {
+      future& self;
+      ~releaser() { self.reset(); }
+    } const release{*this};
+    state_->get();
+  }
+
+  /**
+   * Same as future<T>::then but callable takes no arguments.
+   */
+  template <class Executor, class F, class U = decltype(std::declval<typename std::decay<F>::type&>()())>
+  future<U> then(Executor& executor, F&& callable) {
+    return then_impl<U>(executor, std::forward<F>(callable));
+  }
+
+private:
+  friend class basic_promise<void>;
+
+  explicit future(future_state<void>* state)
+      : basic_future<void>{state} {
+  }
+};
+
+/**
+ * \brief Common part of promise<T> and promise<void>.
+ *
+ * If it is destroyed unsatisfied the future gets a broken_promise error.
+ */
+template <class T>
+class basic_promise {
+public:
+  basic_promise()
+      : state_{new future_state<T>} {
+  }
+
+  basic_promise(basic_promise&& other) noexcept
+      : state_{other.state_} {
+    other.state_ = nullptr;
+  }
+
+  basic_promise& operator=(basic_promise&& other) noexcept {
+    if (this != &other) {
+      abandon();
+      state_ = other.state_;
+      other.state_ = nullptr;
+    }
+    return *this;
+  }
+
+  ~basic_promise() { abandon(); }
+
+  basic_promise(const basic_promise&) = delete;
+  basic_promise& operator=(const basic_promise&) = delete;
+
+  future<T> get_future() {
+    check();
+    if (state_->retrieved_) {
+      throw future_error(std::future_errc::future_already_retrieved);
+    }
+    state_->retrieved_ = true;
+    state_->add_ref();
+    return future<T>{state_};
+  }
+
+  void set_exception(std::exception_ptr exception) {
+    check_unsatisfied();
+    state_->set_exception(std::move(exception));
+  }
+
+protected:
+  void check() const {
+    if (state_ == nullptr) {
+      throw future_error(std::future_errc::no_state);
+    }
+  }
+
+  void check_unsatisfied() const {
+    check();
+    if (state_->is_ready()) {
+      throw future_error(std::future_errc::promise_already_satisfied);
+    }
+  }
+
+  void abandon() {
+    if (state_ != nullptr) {
+      if (!state_->is_ready()) {
+        state_->set_exception(std::make_exception_ptr(future_error(std::future_errc::broken_promise)));
+      }
+      state_->release();
+      state_ = nullptr;
+    }
+  }
+
+protected:
+  future_state<T>* state_;
+};
+
+template <class T>
+class promise : public basic_promise<T> {
+public:
+  promise() = default;
+  promise(promise&&) noexcept = default;
+  promise& operator=(promise&&) noexcept = default;
+
+  void set_value(const T& value) {
+    this->check_unsatisfied();
+    this->state_->set_value(value);
+  }
+
+  void set_value(T&& value) {
+    this->check_unsatisfied();
+    this->state_->set_value(std::move(value));
+  }
+};
+
+template <class T>
+class promise<T&> : public basic_promise<T&> {
+public:
+  promise() = default;
+  promise(promise&&) noexcept = default;
+  promise& operator=(promise&&) noexcept = default;
+
+  /**
+   * Only the reference is kept, value has to outlive the future.
+   */
+  void set_value(T& value) {
+    this->check_unsatisfied();
+    this->state_->set_value(value);
+  }
+};
+
+template <>
+class promise<void> : public basic_promise<void> {
+public:
+  promise() = default;
+  promise(promise&&) noexcept = default;
+  promise& operator=(promise&&) noexcept = default;
+
+  void set_value() {
+    check_unsatisfied();
+    state_->set_value();
+  }
+};
+
+template <class T>
+template <class U, class Executor, class F>
+future<U> basic_future<T>::then_impl(Executor& executor, F&& callable) {
+  using continuation_type = continuation_work<T, typename std::decay<F>::type, U>;
+
+  check();
+  promise<U> promise;
+  auto future = promise.get_future();
+
+  future_state<T>* const state = state_;
+  state_ = nullptr;
+
+  continuation_type continuation{state, std::forward<F>(callable), std::move(promise)};
+  state->set_continuation(std::unique_ptr<work>{new work{
+      work::type_t::STANDARD, post_continuation_work<Executor, continuation_type>{executor, std::move(continuation)}}});
+
+  return future;
+}
+
+/**
+ * \brief The result of when_any, the futures it was given and the index of one that is ready.
+ */
+template <class T>
+struct when_any_result {
+  std::size_t index;
+  std::vector<future<T>> futures;
+};
+
+/**
+ * \brief Shared by the continuations when_all attaches to its futures, the last one to arrive completes it.
+ */
+template <class T>
+class when_all_state {
+public:
+  explicit when_all_state(std::vector<future<T>> futures)
+      : futures_(std::move(futures))
+      , remaining_{futures_.size() + 1} {
+  }
+
+  static future<std::vector<future<T>>> start(std::vector<future<T>> futures) {
+    for (const auto& future : futures) {
+      future.check();
+    }
+
+    const auto state = std::make_shared<when_all_state>(std::move(futures));
+    auto result = state->promise_.get_future();
+    for (auto& future : state->futures_) {
+      future.state_->set_continuation(
+          std::unique_ptr<work>{new work{work::type_t::STANDARD, [state]() { state->arrive(); }}});
+    }
+    // counted as one more so that the futures are not handed out while they are being attached to
+    state->arrive();
+
+    return result;
+  }
+
+private:
+  void arrive() {
+    if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      promise_.set_value(std::move(futures_));
+    }
+  }
+
+private:
+  std::vector<future<T>> futures_;
+  std::atomic<std::size_t> remaining_;
+  promise<std::vector<future<T>>> promise_;
+};
+
+/**
+ * \brief Shared by the continuations when_any attaches to its futures, the first one to arrive completes it.
+ */
+template <class T>
+class when_any_state {
+public:
+  explicit when_any_state(std::vector<future<T>> futures)
+      : futures_(std::move(futures))
+      , first_{std::numeric_limits<std::size_t>::max()}
+      , remaining_{2} {
+  }
+
+  static future<when_any_result<T>> start(std::vector<future<T>> futures) {
+    for (const auto& future : futures) {
+      future.check();
+    }
+
+    const auto state = std::make_shared<when_any_state>(std::move(futures));
+    auto result = state->promise_.get_future();
+    for (std::size_t i = 0; i < state->futures_.size(); ++i) {
+      state->futures_[i].state_->set_continuation(
+          std::unique_ptr<work>{new work{work::type_t::STANDARD, [state, i]() { state->arrive(i); }}});
+    }
+    // completes once a future is ready and all of them have been attached to, or right away if there are none
+    if (state->futures_.empty() || state->remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      state->complete();
+    }
+
+    return result;
+  }
+
+private:
+  void arrive(std::size_t index) {
+    std::size_t first = std::numeric_limits<std::size_t>::max();
+    if (first_.compare_exchange_strong(first, index, std::memory_order_relaxed) &&
+        remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      complete();
+    }
+  }
+
+  void complete() {
+    promise_.set_value(when_any_result<T>{first_.load(std::memory_order_relaxed), std::move(futures_)});
+  }
+
+private:
+  std::vector<future<T>> futures_;
+  std::atomic<std::size_t> first_;
+  std::atomic<std::size_t> remaining_;
+  promise<when_any_result<T>> promise_;
+};
+
+/**
+ * \brief when_all Makes a future that becomes ready once all of futures are, holding them.
+ *
+ * Nobody blocks in the meantime, whoever makes the last of futures ready completes it. The
+ * futures are handed back as they are, so their values and exceptions are taken from them
+ * as usual, but then can not be called on them anymore.
+ *
+ * \throws future_error If one of futures is not valid.
+ */
+template <class T>
+future<std::vector<future<T>>> when_all(std::vector<future<T>> futures) {
+  return when_all_state<T>::start(std::move(futures));
+}
+
+/**
+ * \brief when_any Makes a future that becomes ready once one of futures is, holding them.
+ *
+ * Same as when_all otherwise. If futures is empty, the result is ready right away with
+ * the index std::numeric_limits<std::size_t>::max().
+ *
+ * \throws future_error If one of futures is not valid.
+ */
+template <class T>
+future<when_any_result<T>> when_any(std::vector<future<T>> futures) {
+  return when_any_state<T>::start(std::move(futures));
+}
+
+template <class T>
+constexpr unsigned future_state<T>::spin_count;
+
+template <class T>
+constexpr std::chrono::microseconds future_state<T>::help_park_time;
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+
+namespace threadpool11 {
+
+/**
+ * \brief Splits the range into one equally sized block per worker.
+ *
+ * Cheapest to schedule, best when every iteration costs the same.
+ */
+class static_partitioner {};
+
+/**
+ * \brief Hands out chunks of 'chunk' iterations to one task per worker on demand.
+ *
+ * Same as OpenMP's schedule(dynamic, chunk).
+ */
+class dynamic_partitioner {
+public:
+  explicit dynamic_partitioner(std::size_t chunk = 1)
+      : chunk_{chunk > 0 ? chunk : 1} {
+  }
+
+  std::size_t chunk() const { return chunk_; }
+
+private:
+  std::size_t chunk_;
+};
+
+/**
+ * \brief Splits the range in halves, up front and then lazily while the running worker has nothing queued.
+ *
+ * The range is first cut into about splits_per_worker ranges per worker. A range taken by a worker
+ * with nothing else queued, e.g. one that stole it, is split further. A range is not split below
+ * 'grain' iterations. This adapts to uneven iterations and to how busy the pool is without
+ * creating a task per iteration.
+ */
+class adaptive_partitioner {
+public:
+  static constexpr std::size_t splits_per_worker = 4;
+
+public:
+  explicit adaptive_partitioner(std::size_t grain = 1)
+      : grain_{grain > 0 ? grain : 1} {
+  }
+
+  std::size_t grain() const { return grain_; }
+
+private:
+  std::size_t grain_;
+};
+
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#if defined(WIN32) && defined(threadpool11_DLL)
+#ifdef threadpool11_EXPORTING
+#define threadpool11_EXPORT __declspec(dllexport)
+#else
+#define threadpool11_EXPORT __declspec(dllimport)
+#endif
+#else
+#define threadpool11_EXPORT
+#endif
+
+namespace threadpool11 {
+
+/**
+ * \brief The CPUs this process may run on, grouped by NUMA node.
+ *
+ * On Linux the nodes are read from /sys/devices/system/node and restricted to
+ * the CPUs in sched_getaffinity. Elsewhere, or if there is no NUMA information,
+ * all CPUs form a single node. Nodes without usable CPUs are left out, so node
+ * numbers are dense and may differ from the kernel's.
+ */
+class topology {
+public:
+  using size_type = std::size_t;
+
+public:
+  /**
+   * Builds a topology out of a CPU list per node, mostly useful for testing placements.
+   */
+  threadpool11_EXPORT explicit topology(std::vector<std::vector<unsigned>> nodes);
+
+  /**
+   * \return The topology of the machine, discovered on the first call.
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT static const topology& get();
+
+  size_type node_count() const { return nodes_.size(); }
+  const std::vector<unsigned>& node_cpus(size_type node) const { return nodes_[node]; }
+
+  /**
+   * \return The node of cpu, 0 if cpu is unknown.
+   */
+  threadpool11_EXPORT size_type node_of(unsigned cpu) const;
+
+  /**
+   * \return The node of the CPU the calling thread is running on, 0 if it cannot be told.
+   */
+  threadpool11_EXPORT size_type current_node() const;
+
+private:
+  std::vector<std::vector<unsigned>> nodes_;
+  std::vector<size_type> cpu_nodes_;
+};
+
+/**
+ * \brief Pins the calling thread to cpus.
+ *
+ * \return false if the thread could not be pinned, always on platforms other than Linux.
+ */
+threadpool11_EXPORT bool set_thread_affinity(const std::vector<unsigned>& cpus);
+
+/**
+ * \brief Where the workers of a pool run, see pool::pool.
+ *
+ * Workers are numbered by the order they are first spawned in, a worker that is
+ * spawned in place of a removed one takes over its number.
+ *
+ * policy_t::NONE: Workers are not pinned and the pool does not look at NUMA nodes.
+ * policy_t::COMPACT: Worker i is pinned to the i'th CPU, filling up one node after the other.
+ * policy_t::SCATTER: Workers are pinned to one CPU each, going round robin over the nodes.
+ * policy_t::NUMA_NODE: Workers go round robin over the nodes and are pinned to all CPUs of their node.
+ * policy_t::CPU_LIST: Worker i is pinned to the i'th CPU of the given list.
+ *
+ * Worker numbers wrap around once there are more workers than CPUs.
+ */
+class placement {
+public:
+  using size_type = std::size_t;
+
+  enum class policy_t {
+    NONE,
+    COMPACT,
+    SCATTER,
+    NUMA_NODE,
+    CPU_LIST,
+  };
+
+  /**
+   * The CPUs a worker is pinned to, empty if it is not pinned, and the node it belongs to.
+   */
+  struct assignment {
+    std::vector<unsigned> cpus;
+    size_type node;
+  };
+
+public:
+  /**
+   * policy_t::CPU_LIST without a list of CPUs is the same as policy_t::NONE, as with an empty list.
+   */
+  placement(policy_t policy = policy_t::NONE)
+      : policy_{policy == policy_t::CPU_LIST ? policy_t::NONE : policy} {
+  }
+
+  /**
+   * Same as placement(policy_t::CPU_LIST) with the given list of CPUs, policy_t::NONE if it is empty.
+   */
+  explicit placement(std::vector<unsigned> cpus)
+      : policy_{cpus.empty() ? policy_t::NONE : policy_t::CPU_LIST}
+      , cpus_(std::move(cpus)) {
+  }
+
+  policy_t policy() const { return policy_; }
+  const std::vector<unsigned>& cpus() const { return cpus_; }
+
+  threadpool11_EXPORT assignment assign(size_type worker, const topology& topology) const;
+
+private:
+  policy_t policy_;
+  std::vector<unsigned> cpus_;
+};
+
+}
+
+#undef threadpool11_EXPORT
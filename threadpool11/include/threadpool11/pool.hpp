@@ -1,264 +1,1790 @@
-﻿#pragma once
-
-#include "work.hpp"
-
-#include <boost/lockfree/queue.hpp>
-
-#include <atomic>
-#include <cassert>
-#include <condition_variable>
-#include <functional>
-#include <future>
-#include <memory>
-#include <mutex>
-
-#if defined(WIN32) && defined(threadpool11_DLL)
-#ifdef threadpool11_EXPORTING
-#define threadpool11_EXPORT __declspec(dllexport)
-#else
-#define threadpool11_EXPORT __declspec(dllimport)
-#endif
-#else
-#define threadpool11_EXPORT
-#endif
-
-namespace threadpool11 {
-
-class pool {
-public:
-  enum class method_t {
-    SYNC,
-    ASYNC,
-  };
-  template <class T>
-  using callable_t = std::function<T()>;
-  using size_type = std::size_t;
-
-private:
-  using work_t = work;
-  using queue_t = boost::lockfree::queue<work_t*>;
-  class no_future_t { friend class pool; no_future_t() {} };
-
-public:
-  threadpool11_EXPORT pool(size_type worker_count = std::thread::hardware_concurrency() / 2);
-
-  ~pool();
-
-  /**
-   * \brief Posts a work to the pool for getting processed.
-   *
-   * if there are no threads left (i.e. you called pool::join_all(); prior to
-   * this function) all the works you post gets enqueued. if you spawn new threads in
-   * the future, they will be executed then.
-   *
-   * properties: thread-safe.
-   */
-  template <class T>
-  threadpool11_EXPORT std::future<T> post_work(callable_t<T> callable) {
-    return post_work(work_t::type_t::STANDARD, std::move(callable));
-  }
-
-  /**
-   * Same as post_work(callable_t<T>) except does not have the overhead of futures.
-   */
-  template <class T>
-  threadpool11_EXPORT void post_work(callable_t<T> callable, no_future_t) {
-    return post_work(work_t::type_t::STANDARD, std::move(callable), no_future_tag);
-  }
-
-  /**
-   * \brief join_all Joins the worker threads.
-   *
-   * This function joins all the threads in the thread pool as fast as possible.
-   * All the posted works are NOT GUARANTEED to be finished before the worker threads
-   * are destroyed and this function returns.
-   *
-   * However, ongoing works in the threads in the pool are guaranteed
-   * to finish before that threads are terminated.
-   *
-   * Properties: NOT thread-safe.
-   */
-  threadpool11_EXPORT void join_all();
-
-  /**
-   * \brief get_worker_count
-   *
-   * \return The number of worker threads.
-   *
-   * Properties: NOT thread-safe.
-   */
-  threadpool11_EXPORT size_type get_worker_count() const { return worker_count_; }
-
-  /**
-   * \brief set_worker_count
-   * \param n The number to set worker count to.
-   * \param method The method to use for when the thread count is being decreased.
-   *
-   * method_t::ASYNC: It will return before the threads are joined. It will just post
-   *  'n' requests for termination. This means that if you call this function multiple times,
-   *  worker termination requests will pile up. It can even kill the newly
-   *  created workers if all workers are removed before all requests are processed.
-   *
-   * method_t::SYNC: It won't return until the specified number of workers are actually destroyed.
-   *  There still may be a few milliseconds delay before value returned by pool::get_worker_count is updated.
-   *  But it will be more accurate compared to ASYNC one.
-   *
-   * Properties: NOT thread-safe.
-   */
-  threadpool11_EXPORT void set_worker_count(size_type n, method_t method = method_t::ASYNC);
-
-  /**
-   * \brief get_work_queue_size
-   *
-   * \return The number of work items that has not been acquired by workers.
-   *
-   * Properties: thread-safe.
-   */
-  threadpool11_EXPORT size_type get_work_queue_size() const { return work_queue_size_.load(std::memory_order_relaxed); }
-
-  /**
-   * \brief increase_worker_count Increases the number of threads in the pool by n.
-   *
-   * Properties: NOT thread-safe.
-   */
-  threadpool11_EXPORT void increase_worker_count(size_type n);
-
-  /**
-   * \brief decrease_worker_count Tries to decrease the number of threads in the pool by n.
-   *
-   * Setting 'n' higher than the number of workers has no effect.
-   * Calling without arguments asynchronously terminates all workers.
-   *
-   * \warning This function behaves different based on second parameter.
-   *
-   * method_t::ASYNC: It will return before the threads are joined. It will just post
-   *  'n' requests for termination. This means that if you call this function multiple times,
-   *  worker termination requests will pile up. It can even kill the newly
-   *  created workers if all workers are removed before all requests are processed.
-   *
-   * method_t::SYNC: It won't return until the specified number of workers are actually destroyed.
-   *  There still may be a few milliseconds delay before value returned by pool::get_worker_count is updated.
-   *  But it will be more accurate compared to ASYNC one.
-   *
-   * Properties: NOT thread-safe.
-   */
-  threadpool11_EXPORT void decrease_worker_count(size_type n = std::numeric_limits<size_type>::max(),
-                                                 method_t method = method_t::ASYNC);
-
-private:
-  using mutex_t = std::mutex;
-  using cv_t = std::condition_variable;
-
-private:
-  pool(pool&&) = delete;
-  pool(pool const&) = delete;
-  pool& operator=(pool&&) = delete;
-  pool& operator=(pool const&) = delete;
-
-  template <class T>
-  threadpool11_EXPORT std::future<T> post_work(work_t::type_t type, callable_t<T> callable);
-
-  template <class T>
-  threadpool11_EXPORT void post_work(work_t::type_t type, callable_t<T> callable, no_future_t);
-
-  template <class T>
-  static void call_helper(callable_t<T> callable, std::shared_ptr<std::promise<T>> promise);
-
-  template <class T>
-  static void call_helper(callable_t<T> callable);
-
-  void push(std::unique_ptr<work_t> work);
-
-  void worker_main();
-
-public:
-  static const no_future_t no_future_tag;
-
-private:
-  size_type worker_count_;
-
-  mutable mutex_t work_signal_mutex_;
-  cv_t work_signal_;
-
-  queue_t work_queue_;
-  std::atomic<size_type> work_queue_size_;
-};
-
-template <class T>
-inline void pool::call_helper(callable_t<T> callable, std::shared_ptr<std::promise<T>> promise) {
-  auto&& val = callable();
-  promise->set_value(std::move(val));
-}
-
-template <>
-inline void pool::call_helper<void>(callable_t<void> callable, std::shared_ptr<std::promise<void>> promise) {
-  callable();
-  promise->set_value();
-}
-
-template <class T>
-inline void pool::call_helper(callable_t<T> callable) {
-  callable();
-}
-
-template <class T>
-threadpool11_EXPORT inline std::future<T> pool::post_work(work_t::type_t type, callable_t<T> callable) {
-  auto promise = std::make_shared<std::promise<T>>();
-  auto future = promise->get_future();
-  std::function<void()> func = std::bind(
-    static_cast<void(*)(callable_t<T>, std::shared_ptr<std::promise<T>>)>(&pool::call_helper<T>),
-    std::move(callable),
-    std::move(promise));
-
-  std::unique_ptr<work_t> work{new work_t{std::move(type), std::move(func)}};
-
-  push(std::move(work));
-
-  return future;
-}
-
-template <class T>
-threadpool11_EXPORT inline void pool::post_work(work_t::type_t type, callable_t<T> callable, no_future_t) {
-  std::function<void()> func = std::bind(
-    static_cast<void(*)(callable_t<T>)>(&pool::call_helper<T>),
-    std::move(callable));
-
-  std::unique_ptr<work_t> work{new work_t{std::move(type), std::move(func)}};
-
-  push(std::move(work));
-}
-
-inline void pool::push(std::unique_ptr<work_t> work) {
-  work_queue_.push(work.release());
-
-  {
-    std::lock_guard<mutex_t> work_signal_lock(work_signal_mutex_);
-    work_queue_size_.fetch_add(1, std::memory_order_relaxed);
-  }
-  work_signal_.notify_one();
-}
-
-inline void pool::worker_main() {
-  while (true) {
-    work_t* work_ptr;
-
-    while (work_queue_.pop(work_ptr)) {
-      const std::unique_ptr<work_t> work(work_ptr);
-
-      work_queue_size_.fetch_sub(1, std::memory_order_relaxed);
-
-      (*work)();
-
-      if (work->type() == work_t::type_t::TERMINAL) {
-        return;
-      }
-    }
-
-    std::unique_lock<mutex_t> work_signal_lock(work_signal_mutex_);
-    work_signal_.wait(work_signal_lock, [this]() { return work_queue_size_.load(std::memory_order_relaxed) > 0; });
-  }
-}
-
-#undef threadpool11_EXPORT
-#undef threadpool11_EXPORTING
-}
+﻿#pragma once
+
+#include "cancellation.hpp"
+#include "event_count.hpp"
+#include "future.hpp"
+#include "partitioner.hpp"
+#include "placement.hpp"
+#include "stats.hpp"
+#include "task_graph.hpp"
+#include "thread_cache.hpp"
+#include "timer_wheel.hpp"
+#include "work.hpp"
+
+#include <boost/lockfree/queue.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <functional>
+#include <exception>
+#include <future>
+#include <iosfwd>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(WIN32) && defined(threadpool11_DLL)
+#ifdef threadpool11_EXPORTING
+#define threadpool11_EXPORT __declspec(dllexport)
+#else
+#define threadpool11_EXPORT __declspec(dllimport)
+#endif
+#else
+#define threadpool11_EXPORT
+#endif
+
+// C++20 coroutine support, see coroutine.hpp. The library itself does not need it.
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define threadpool11_COROUTINES
+#endif
+#endif
+
+namespace threadpool11 {
+
+#if defined(threadpool11_COROUTINES)
+class schedule_awaiter;
+#endif
+
+/**
+ * \brief A callable together with the name its work has in pool::trace, see labelled.
+ */
+template <class F>
+class labelled_callable {
+public:
+  template <class G>
+  labelled_callable(const char* label, G&& callable)
+      : label_{label}
+      , callable_(std::forward<G>(callable)) {
+  }
+
+  auto operator()() -> decltype(std::declval<F&>()()) { return callable_(); }
+
+  const char* label() const { return label_; }
+
+private:
+  const char* label_;
+  F callable_;
+};
+
+/**
+ * \brief Names the work of callable in pool::trace and pool::dump_trace, whichever way it is posted.
+ *
+ *   pool.post_work(pool::priority_t::HIGH, labelled("flush", [&]() { ... }));
+ *
+ * The label is not copied, it has to outlive the pool's trace, e.g. a string literal.
+ * Unless built with threadpool11_TRACE defined the callable is returned as it is.
+ */
+#if defined(threadpool11_TRACE)
+template <class F>
+labelled_callable<typename std::decay<F>::type> labelled(const char* label, F&& callable) {
+  return labelled_callable<typename std::decay<F>::type>{label, std::forward<F>(callable)};
+}
+#else
+template <class F>
+typename std::decay<F>::type labelled(const char*, F&& callable) {
+  return std::forward<F>(callable);
+}
+#endif
+
+class pool {
+public:
+  enum class method_t {
+    SYNC,
+    ASYNC,
+  };
+  /**
+   * Works of a higher priority are picked up first, see post_work(priority_t, F&&).
+   */
+  enum class priority_t {
+    HIGH,
+    NORMAL,
+    LOW,
+  };
+  template <class T>
+  using callable_t = std::function<T()>;
+  using size_type = std::size_t;
+
+  static constexpr size_type priority_count = 3;
+
+  /**
+   * \brief How a worker waits once it finds no work.
+   *
+   * It retries spin_count times with a CPU pause in between, then yield_count times
+   * giving up its time slice in between, then parks until a work is posted.
+   * Spinning lowers the wakeup latency at the cost of burning CPU while idle.
+   *
+   * An idle worker takes works posted to another worker with post_to only once that worker
+   * has not taken any from its inbox for inbox_steal_delay.
+   */
+  struct idle_policy {
+    idle_policy(size_type spin_count = 64, size_type yield_count = 8,
+                std::chrono::microseconds inbox_steal_delay = std::chrono::milliseconds(1))
+        : spin_count{spin_count}
+        , yield_count{yield_count}
+        , inbox_steal_delay{inbox_steal_delay} {
+    }
+
+    size_type spin_count;
+    size_type yield_count;
+    std::chrono::microseconds inbox_steal_delay;
+  };
+
+  /**
+   * \brief When the pool adds and removes workers by itself, see set_autoscale_policy.
+   *
+   * A worker is added once more than queue_depth works per worker have been waiting for
+   * scale_up_delay, and right away if there are no workers. A worker that has not found
+   * any work for keep_alive leaves. The worker count stays within [min_workers, max_workers].
+   */
+  struct autoscale_policy {
+    autoscale_policy(size_type min_workers = 1,
+                     size_type max_workers = std::max<size_type>(1, std::thread::hardware_concurrency()),
+                     std::chrono::milliseconds keep_alive = std::chrono::seconds(10), size_type queue_depth = 2,
+                     std::chrono::microseconds scale_up_delay = std::chrono::milliseconds(1))
+        : min_workers{min_workers}
+        , max_workers{std::max(min_workers, max_workers)}
+        , keep_alive{keep_alive}
+        , queue_depth{queue_depth}
+        , scale_up_delay{scale_up_delay} {
+    }
+
+    size_type min_workers;
+    size_type max_workers;
+    std::chrono::milliseconds keep_alive;
+    size_type queue_depth;
+    std::chrono::microseconds scale_up_delay;
+  };
+
+private:
+  using work_t = work;
+  using queue_t = boost::lockfree::queue<work_t*>;
+  class no_future_t { friend class pool; no_future_t() {} };
+
+  template <class F>
+  using result_t = decltype(std::declval<typename std::decay<F>::type&>()());
+
+  using timer_clock = timer_wheel::clock;
+
+public:
+  class strand;
+
+  /**
+   * Number of strands post_keyed spreads the keys over.
+   */
+  static constexpr size_type keyed_strand_count = 64;
+
+  /**
+   * Returned by current_worker_index when not called from a worker of the pool.
+   */
+  static constexpr size_type no_worker = std::numeric_limits<size_type>::max();
+
+  /**
+   * Number of trace events a worker keeps, see trace.
+   */
+  static constexpr size_type trace_capacity = 8192;
+
+  /**
+   * \brief Marks the work running on the calling worker as blocked while it lives, e.g. on disk or socket I/O.
+   *
+   * One more worker is brought up for the time being, on a spare thread of the thread cache,
+   * so that as many workers as the worker count stay runnable. Once the scope ends, the
+   * first worker to run out of work leaves again. Nested scopes count once and a scope made
+   * outside the workers of the pool does nothing. See also post_blocking.
+   *
+   * Properties: not thread-safe, has to end in the thread that made it.
+   */
+  class blocking_scope {
+  public:
+    threadpool11_EXPORT explicit blocking_scope(pool& owner);
+    threadpool11_EXPORT ~blocking_scope();
+
+    blocking_scope(const blocking_scope&) = delete;
+    blocking_scope& operator=(const blocking_scope&) = delete;
+
+  private:
+    // null outside the workers of the pool
+    pool* owner_;
+  };
+
+  /**
+   * \brief Spawns worker_count workers placed according to placement.
+   *
+   * The workers are started on the first post, a pool that never gets any work starts no
+   * threads. Worker threads come from and go back to thread_cache, so short-lived pools
+   * mostly reuse the threads of the pools before them.
+   *
+   * With a placement other than placement::policy_t::NONE the workers are pinned to CPUs and
+   * grouped by NUMA node. Every node gets its own queues, works posted from outside the pool go
+   * to the queues of the node the posting thread runs on, and workers look at their own node's
+   * queues and deques before turning to other nodes.
+   */
+  threadpool11_EXPORT pool(size_type worker_count = std::max<size_type>(1, std::thread::hardware_concurrency() / 2),
+                           const threadpool11::placement& placement = threadpool11::placement());
+
+  ~pool();
+
+  /**
+   * \brief Posts a work to the pool for getting processed.
+   *
+   * if there are no threads left (i.e. you called pool::join_all(); prior to
+   * this function) all the works you post gets enqueued. if you spawn new threads in
+   * the future, they will be executed then.
+   *
+   * Works posted from a worker thread of this pool go to that worker's own deque
+   * and are picked up by it in LIFO order, idle workers steal them otherwise.
+   * Works posted from other threads go to the shared queue.
+   *
+   * If the pool has a capacity, see set_capacity, posting from other threads waits
+   * until there is space in the queue.
+   *
+   * properties: thread-safe.
+   */
+  template <class T>
+  threadpool11_EXPORT future<T> post_work(callable_t<T> callable) {
+    return post_work(work_t::type_t::STANDARD, priority_t::NORMAL, std::move(callable), nullptr);
+  }
+
+  /**
+   * Same as post_work(callable_t<T>) except does not have the overhead of futures.
+   */
+  template <class T>
+  threadpool11_EXPORT void post_work(callable_t<T> callable, no_future_t) {
+    return post_work(work_t::type_t::STANDARD, priority_t::NORMAL, std::move(callable), no_future_tag,
+                     nullptr);
+  }
+
+  /**
+   * Same as post_work(callable_t<T>) but takes any callable and deduces the result type.
+   *
+   * The callable is not wrapped in a std::function, callables that fit in work::storage_size
+   * bytes are stored inline in the work so that no allocation is made for them.
+   */
+  template <class F, class R = result_t<F>>
+  threadpool11_EXPORT future<R> post_work(F&& callable) {
+    return post_work(work_t::type_t::STANDARD, priority_t::NORMAL, std::forward<F>(callable),
+                     label_of(callable));
+  }
+
+  /**
+   * Same as post_work(F&&) except does not have the overhead of futures.
+   */
+  template <class F, class = result_t<F>>
+  threadpool11_EXPORT void post_work(F&& callable, no_future_t) {
+    return post_work(work_t::type_t::STANDARD, priority_t::NORMAL, std::forward<F>(callable), no_future_tag,
+                     label_of(callable));
+  }
+
+  /**
+   * \brief Same as post_work(F&&) but with the given priority.
+   *
+   * Every priority level has its own queue. Workers take works from the highest priority
+   * level that has any, except that every now and then they look at the levels in reverse
+   * order so that lower priority works do not starve under a steady flow of higher ones.
+   *
+   * Works of priority_t::NORMAL posted from a worker go to its deque as usual, other
+   * priorities always go to the queue of their level.
+   *
+   * Properties: thread-safe.
+   */
+  template <class F, class R = result_t<F>>
+  threadpool11_EXPORT future<R> post_work(priority_t priority, F&& callable) {
+    return post_work(work_t::type_t::STANDARD, priority, std::forward<F>(callable), label_of(callable));
+  }
+
+  /**
+   * Same as post_work(priority_t, F&&) except does not have the overhead of futures.
+   */
+  template <class F, class = result_t<F>>
+  threadpool11_EXPORT void post_work(priority_t priority, F&& callable, no_future_t) {
+    return post_work(work_t::type_t::STANDARD, priority, std::forward<F>(callable), no_future_tag,
+                     label_of(callable));
+  }
+
+  /**
+   * \brief Same as post_work(F&&) but the work shows up as label in trace and dump_trace.
+   *
+   * The label is not copied, it has to outlive the pool's trace, e.g. a string literal.
+   * It is dropped unless built with threadpool11_TRACE defined. Works posted any other way
+   * are named with labelled.
+   *
+   * Properties: thread-safe.
+   */
+  template <class F, class R = result_t<F>>
+  threadpool11_EXPORT future<R> post_work(const char* label, F&& callable) {
+    return post_work(work_t::type_t::STANDARD, priority_t::NORMAL, std::forward<F>(callable), label);
+  }
+
+  /**
+   * Same as post_work(const char*, F&&) except does not have the overhead of futures.
+   */
+  template <class F, class = result_t<F>>
+  threadpool11_EXPORT void post_work(const char* label, F&& callable, no_future_t) {
+    post_work(work_t::type_t::STANDARD, priority_t::NORMAL, std::forward<F>(callable), no_future_tag, label);
+  }
+
+  /**
+   * \brief Same as post_work(F&&) but the work is dropped if token is cancelled before it starts.
+   *
+   * The worker picking up a cancelled work does not call the callable, it only stores
+   * operation_cancelled in the future. A work that is already running is not interrupted,
+   * it can poll a copy of the token, see cancellation_token::throw_if_cancelled.
+   *
+   * Properties: thread-safe.
+   */
+  template <class F, class R = result_t<F>>
+  threadpool11_EXPORT future<R> post_work(const cancellation_token& token, F&& callable) {
+    return post_work(priority_t::NORMAL, token, std::forward<F>(callable));
+  }
+
+  /**
+   * Same as post_work(const cancellation_token&, F&&) except does not have the overhead of futures.
+   */
+  template <class F, class = result_t<F>>
+  threadpool11_EXPORT void post_work(const cancellation_token& token, F&& callable, no_future_t) {
+    post_work(priority_t::NORMAL, token, std::forward<F>(callable), no_future_tag);
+  }
+
+  /**
+   * Same as post_work(const cancellation_token&, F&&) but with the given priority.
+   */
+  template <class F, class R = result_t<F>>
+  threadpool11_EXPORT future<R> post_work(priority_t priority, const cancellation_token& token, F&& callable);
+
+  /**
+   * Same as post_work(priority_t, const cancellation_token&, F&&) except does not have the overhead of futures.
+   */
+  template <class F, class = result_t<F>>
+  threadpool11_EXPORT void post_work(priority_t priority, const cancellation_token& token, F&& callable,
+                                     no_future_t);
+
+  /**
+   * \brief try_post_work Same as post_work(F&&) but fails instead of waiting for space in the queue.
+   *
+   * \return The future of the work, not valid() if the queue was full. The callable is left
+   *  untouched then.
+   *
+   * Properties: thread-safe.
+   */
+  template <class F, class R = result_t<F>>
+  threadpool11_EXPORT future<R> try_post_work(F&& callable) {
+    return post_work_until(timer_clock::time_point::min(), std::forward<F>(callable));
+  }
+
+  /**
+   * Same as try_post_work(F&&) except does not have the overhead of futures.
+   *
+   * \return false if the queue was full.
+   */
+  template <class F, class = result_t<F>>
+  threadpool11_EXPORT bool try_post_work(F&& callable, no_future_t) {
+    return post_work_until(timer_clock::time_point::min(), std::forward<F>(callable), no_future_tag);
+  }
+
+  /**
+   * \brief post_work_for Same as post_work(F&&) but waits at most timeout for space in the queue.
+   *
+   * \return The future of the work, not valid() if there was no space in time. The callable is
+   *  left untouched then.
+   *
+   * Properties: thread-safe.
+   */
+  template <class Rep, class Period, class F, class R = result_t<F>>
+  threadpool11_EXPORT future<R> post_work_for(const std::chrono::duration<Rep, Period>& timeout, F&& callable) {
+    return post_work_until(to_deadline(timeout), std::forward<F>(callable));
+  }
+
+  /**
+   * Same as post_work_for(timeout, F&&) except does not have the overhead of futures.
+   *
+   * \return false if there was no space in time.
+   */
+  template <class Rep, class Period, class F, class = result_t<F>>
+  threadpool11_EXPORT bool post_work_for(const std::chrono::duration<Rep, Period>& timeout, F&& callable,
+                                         no_future_t) {
+    return post_work_until(to_deadline(timeout), std::forward<F>(callable), no_future_tag);
+  }
+
+  /**
+   * \brief post_keyed Posts callable to one of keyed_strand_count strands of the pool chosen by the hash of key.
+   *
+   * Works posted with equal keys run one at a time in the order they were posted, works with
+   * different keys may still share a strand. See strand, defined in strand.hpp.
+   *
+   * Properties: thread-safe.
+   */
+  template <class Key, class F, class R = result_t<F>>
+  future<R> post_keyed(const Key& key, F&& callable);
+
+  /**
+   * Same as post_keyed(const Key&, F&&) except does not have the overhead of futures.
+   */
+  template <class Key, class F, class = result_t<F>>
+  void post_keyed(const Key& key, F&& callable, no_future_t);
+
+  /**
+   * \brief post_to Same as post_work(F&&) but the work goes to the inbox of the worker with the given index.
+   *
+   * The index is taken modulo the number of worker slots, see current_worker_index. A worker
+   * checks its inbox before the shared queues, so works posted to the same index find the data
+   * they share in the cache of the same core. Other idle workers take the works only once the
+   * worker has not taken any for idle_policy::inbox_steal_delay. Posting to a worker that is
+   * not running is the same as post_work(F&&).
+   *
+   * Properties: thread-safe.
+   */
+  template <class F, class R = result_t<F>>
+  threadpool11_EXPORT future<R> post_to(size_type worker_index, F&& callable);
+
+  /**
+   * Same as post_to(size_type, F&&) except does not have the overhead of futures.
+   */
+  template <class F, class = result_t<F>>
+  threadpool11_EXPORT void post_to(size_type worker_index, F&& callable, no_future_t);
+
+  /**
+   * \brief post_near Same as post_to(size_type, F&&) with the worker chosen by the hash of hint.
+   *
+   * Works posted with equal hints, e.g. the shard of the data they update, go to the same
+   * worker as long as the worker count does not change.
+   *
+   * Properties: thread-safe.
+   */
+  template <class Hint, class F, class R = result_t<F>>
+  threadpool11_EXPORT future<R> post_near(const Hint& hint, F&& callable) {
+    return post_to(near_worker(std::hash<Hint>()(hint)), std::forward<F>(callable));
+  }
+
+  /**
+   * Same as post_near(const Hint&, F&&) except does not have the overhead of futures.
+   */
+  template <class Hint, class F, class = result_t<F>>
+  threadpool11_EXPORT void post_near(const Hint& hint, F&& callable, no_future_t) {
+    post_to(near_worker(std::hash<Hint>()(hint)), std::forward<F>(callable), no_future_tag);
+  }
+
+  /**
+   * \brief post_blocking Same as post_work(F&&) but callable runs in a blocking_scope.
+   *
+   * For works that spend most of their time blocked, the pool keeps its other workers
+   * busy with a compensating worker meanwhile instead of having to be oversized.
+   *
+   * Properties: thread-safe.
+   */
+  template <class F, class R = result_t<F>>
+  threadpool11_EXPORT future<R> post_blocking(F&& callable) {
+    return post_work(blocking_work<typename std::decay<F>::type, R>{*this, std::forward<F>(callable)});
+  }
+
+  /**
+   * Same as post_blocking(F&&) except does not have the overhead of futures.
+   */
+  template <class F, class R = result_t<F>>
+  threadpool11_EXPORT void post_blocking(F&& callable, no_future_t) {
+    post_work(blocking_work<typename std::decay<F>::type, R>{*this, std::forward<F>(callable)}, no_future_tag);
+  }
+
+  /**
+   * \brief current_worker_index
+   *
+   * \return The index of the worker slot of this pool the calling thread runs, no_worker if it is
+   * not a worker of this pool. n workers use the indices [0, n), a thread replacing a worker
+   * that left takes over its index.
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT size_type current_worker_index() const;
+
+#if defined(threadpool11_COROUTINES)
+  /**
+   * \brief schedule co_await pool.schedule() suspends the coroutine and resumes it on a worker of the pool.
+   *
+   * The work resuming the coroutine is kept in the coroutine frame, so no allocation is
+   * made per resumption. Defined in coroutine.hpp.
+   *
+   * Properties: thread-safe.
+   */
+  schedule_awaiter schedule();
+#endif
+
+  /**
+   * \brief post_bulk Posts every callable in [first, last) at once.
+   *
+   * The works are enqueued in one go and at most min(n, parked workers) workers are woken up
+   * instead of one per work.
+   *
+   * \return A future that becomes ready when all of the works have finished. If any of them threw,
+   *  the first exception is stored in it.
+   *
+   * Properties: thread-safe.
+   */
+  template <class Iterator>
+  threadpool11_EXPORT future<void> post_bulk(Iterator first, Iterator last);
+
+  /**
+   * \brief post_n Same as post_bulk but posts n works, the i'th one calls callable(i).
+   *
+   * The callable is stored once and shared by the works.
+   *
+   * Properties: thread-safe.
+   */
+  template <class F>
+  threadpool11_EXPORT future<void> post_n(size_type n, F&& callable);
+
+  /**
+   * \brief post_after Same as post_work(F&&) but the work is not posted before delay has passed.
+   *
+   * Timers are kept in a timer_wheel that the workers look at whenever they run out of work
+   * or finish one, and parked workers wake up for the earliest one. So an expired timer costs
+   * one push to the queue and there is no timer thread. Timers have a resolution of
+   * timer_wheel::resolution and do not fire while the pool has no workers.
+   *
+   * Properties: thread-safe.
+   */
+  template <class Rep, class Period, class F, class R = result_t<F>>
+  threadpool11_EXPORT future<R> post_after(const std::chrono::duration<Rep, Period>& delay, F&& callable) {
+    return post_at(timer_clock::now() + delay, std::forward<F>(callable));
+  }
+
+  /**
+   * Same as post_after(delay, F&&) except does not have the overhead of futures.
+   */
+  template <class Rep, class Period, class F, class = result_t<F>>
+  threadpool11_EXPORT void post_after(const std::chrono::duration<Rep, Period>& delay, F&& callable, no_future_t) {
+    post_at(timer_clock::now() + delay, std::forward<F>(callable), no_future_tag);
+  }
+
+  /**
+   * \brief post_at Same as post_after but takes the time point to post the work at.
+   *
+   * Time points of clocks other than std::chrono::steady_clock are converted to it once,
+   * later adjustments of their clock are not followed.
+   *
+   * Properties: thread-safe.
+   */
+  template <class Clock, class Duration, class F, class R = result_t<F>>
+  threadpool11_EXPORT future<R> post_at(const std::chrono::time_point<Clock, Duration>& deadline, F&& callable);
+
+  /**
+   * Same as post_at(deadline, F&&) except does not have the overhead of futures.
+   */
+  template <class Clock, class Duration, class F, class = result_t<F>>
+  threadpool11_EXPORT void post_at(const std::chrono::time_point<Clock, Duration>& deadline, F&& callable,
+                                   no_future_t);
+
+  /**
+   * \brief post_every Posts callable every period, starting one period from now.
+   *
+   * If callable returns bool, returning false stops it. Otherwise it is posted until
+   * the pool is destroyed. The next run is scheduled after the previous one has finished,
+   * runs that are missed meanwhile are skipped rather than run back to back.
+   *
+   * \throws std::invalid_argument If period is not positive.
+   *
+   * Properties: thread-safe.
+   */
+  template <class Rep, class Period, class F>
+  threadpool11_EXPORT void post_every(const std::chrono::duration<Rep, Period>& period, F&& callable);
+
+  /**
+   * \brief parallel_for Calls body(i) for every i in [begin, end) on the workers and waits for them.
+   *
+   * Iterations are grouped into a handful of works according to the partitioner,
+   * see partitioner.hpp. If an iteration throws, the first exception is rethrown once
+   * all works have finished.
+   *
+   * Properties: thread-safe.
+   */
+  template <class Index, class Body, class Partitioner = adaptive_partitioner>
+  threadpool11_EXPORT void parallel_for(Index begin, Index end, Body&& body,
+                                        const Partitioner& partitioner = Partitioner());
+
+  /**
+   * \brief parallel_reduce Folds body(i) for every i in [begin, end) with combine, starting from identity.
+   *
+   * Each work folds its own iterations starting from identity, the partial results are
+   * folded together in no particular order. So combine has to be associative and commutative
+   * and identity has to be its neutral element.
+   *
+   * Properties: thread-safe.
+   */
+  template <class Index, class T, class Body, class Combine, class Partitioner = adaptive_partitioner>
+  threadpool11_EXPORT T parallel_reduce(Index begin, Index end, T identity, Body&& body, Combine&& combine,
+                                        const Partitioner& partitioner = Partitioner());
+
+  /**
+   * \brief run Runs every work of graph once all of its predecessors have finished.
+   *
+   * The roots are posted right away, any other work is posted by the worker that finishes
+   * its last predecessor. If a work throws, the works that have not started yet are skipped.
+   * The graph must outlive the returned future and must not be modified until then.
+   *
+   * \return A future that becomes ready when the whole graph has finished. If any of the works
+   *  threw, the first exception is stored in it.
+   * \throws std::invalid_argument If the dependencies of graph have a cycle.
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT future<void> run(task_graph& graph);
+
+  /**
+   * \brief join_all Joins the worker threads.
+   *
+   * This function joins all the threads in the thread pool as fast as possible.
+   * All the posted works are NOT GUARANTEED to be finished before the worker threads
+   * are destroyed and this function returns.
+   *
+   * However, ongoing works in the threads in the pool are guaranteed
+   * to finish before that threads are terminated.
+   *
+   * Turns autoscaling off so that no new workers are started.
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT void join_all();
+
+  /**
+   * \brief get_worker_count
+   *
+   * \return The number of worker threads. Workers that are about to leave are not counted.
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT size_type get_worker_count() const { return worker_count_.load(std::memory_order_relaxed); }
+
+  /**
+   * \brief set_worker_count
+   * \param n The number to set worker count to.
+   * \param method The method to use for when the thread count is being decreased, see decrease_worker_count.
+   *
+   * The worker count is swapped for n in one step, concurrent calls leave it at one of the counts asked for.
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT void set_worker_count(size_type n, method_t method = method_t::ASYNC);
+
+  /**
+   * \brief get_work_queue_size
+   *
+   * \return The number of work items that has not been acquired by workers.
+   *
+   * Sums a handful of counters, one per producer shard, without taking any lock.
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT size_type get_work_queue_size() const { return queued_work_count(std::memory_order_relaxed); }
+
+  /**
+   * \brief set_capacity Limits the number of works waiting in the queue, 0 means no limit which is the default.
+   *
+   * Once the queue holds capacity works, posting from threads other than the pool's workers
+   * waits for space, see try_post_work and post_work_for for the alternatives. A bulk post of
+   * more works than the capacity goes through once the queue is empty. Workers of the pool,
+   * expired timers and continuations run by workers never wait since only workers make space.
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT void set_capacity(size_type capacity);
+
+  threadpool11_EXPORT size_type get_capacity() const { return capacity_.load(std::memory_order_relaxed); }
+
+  /**
+   * \brief get_work_queue_size
+   *
+   * \return The number of work items of the given priority that has not been acquired by workers.
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT size_type get_work_queue_size(priority_t priority) const {
+    return levels_[static_cast<size_type>(priority)].size.load(std::memory_order_relaxed) +
+           (priority == priority_t::NORMAL ? sharded_work_count(std::memory_order_relaxed) +
+                                                 inbox_work_count_.load(std::memory_order_relaxed)
+                                           : 0);
+  }
+
+  /**
+   * \brief snapshot Collects the statistics of the workers.
+   *
+   * Only recorded if the library and its users are built with threadpool11_STATS defined
+   * (cmake -Dthreadpool11_STATS=ON), the result is empty otherwise and recording costs nothing.
+   * Counters are written by their worker without synchronization, so a snapshot taken while
+   * the pool is busy may mix counters from slightly different times.
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT pool_stats snapshot() const;
+
+  /**
+   * \brief trace Collects the last trace_capacity works run by each worker, oldest first per worker.
+   *
+   * Only recorded if the library and its users are built with threadpool11_TRACE defined
+   * (cmake -Dthreadpool11_TRACE=ON), the result is empty otherwise and recording costs nothing.
+   * Workers record without locks, events they overwrite while being copied are left out.
+   * Works are stamped with the TSC on x86, the first call in a process spends 10ms measuring its rate.
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT std::vector<trace_event> trace() const;
+
+  /**
+   * \brief dump_trace Writes trace() as Chrome trace event JSON, to be opened in Perfetto or chrome://tracing.
+   *
+   * Every worker is a thread of its own, works are slices named by their label. The time a work
+   * waited in the queue and whether it was stolen are in the arguments of its slice.
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT void dump_trace(std::ostream& out) const;
+
+  /**
+   * Same as dump_trace(std::ostream&) but writes to the file at path.
+   *
+   * \return false if the file could not be written.
+   */
+  threadpool11_EXPORT bool dump_trace(const std::string& path) const;
+
+  /**
+   * \brief get_idle_policy
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT idle_policy get_idle_policy() const;
+
+  /**
+   * \brief set_idle_policy Sets how idle workers wait for work, see idle_policy.
+   *
+   * Workers pick up the new policy the next time they run out of work.
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT void set_idle_policy(const idle_policy& policy);
+
+  /**
+   * \brief set_autoscale_policy Lets the pool add and remove workers according to policy.
+   *
+   * The worker count is brought into [policy.min_workers, policy.max_workers] right away.
+   * Workers can still be added and removed by hand meanwhile.
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT void set_autoscale_policy(const autoscale_policy& policy);
+
+  /**
+   * \brief disable_autoscale Leaves the worker count as it is from now on.
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT void disable_autoscale();
+
+  /**
+   * \brief get_autoscale_policy
+   *
+   * \return The last policy set, meaningful only while is_autoscaling().
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT autoscale_policy get_autoscale_policy() const;
+
+  threadpool11_EXPORT bool is_autoscaling() const { return autoscale_.load(std::memory_order_relaxed); }
+
+  /**
+   * \brief increase_worker_count Increases the number of threads in the pool by n.
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT void increase_worker_count(size_type n);
+
+  /**
+   * \brief decrease_worker_count Tries to decrease the number of threads in the pool by n.
+   *
+   * Setting 'n' higher than the number of workers removes all of them.
+   * Calling without arguments asynchronously terminates all workers.
+   *
+   * The worker count is lowered right away and all parked workers are woken up, as many
+   * workers as there are too many leave once they finish their current work. Nothing is
+   * posted for it, so decreasing and increasing again does not kill the new workers. When all
+   * workers are removed, the last ones leave once there are no more posted works.
+   *
+   * method_t::ASYNC: It returns without waiting for the workers to leave.
+   *
+   * method_t::SYNC: It won't return until the worker threads are at most as many as the
+   *  worker count, i.e. the leaving workers are done with the pool.
+   *
+   * Properties: thread-safe.
+   */
+  threadpool11_EXPORT void decrease_worker_count(size_type n = std::numeric_limits<size_type>::max(),
+                                                 method_t method = method_t::ASYNC);
+
+private:
+  using mutex_t = std::mutex;
+
+  class worker;
+  class worker_table;
+  struct level_t;
+  struct exit_state;
+
+#if defined(threadpool11_COROUTINES)
+  friend class schedule_awaiter;
+#endif
+
+private:
+  pool(pool&&) = delete;
+  pool(pool const&) = delete;
+  pool& operator=(pool&&) = delete;
+  pool& operator=(pool const&) = delete;
+
+  /**
+   * All the plain posts end up here, label is what the work is named in the trace.
+   */
+  template <class F, class R = result_t<F>>
+  threadpool11_EXPORT future<R> post_work(work_t::type_t type, priority_t priority, F&& callable,
+                                          const char* label);
+
+  template <class F>
+  threadpool11_EXPORT void post_work(work_t::type_t type, priority_t priority, F&& callable, no_future_t,
+                                     const char* label);
+
+  /**
+   * The label of a callable wrapped with labelled, nullptr for the others.
+   */
+  template <class F>
+  static const char* label_of(const F&) {
+    return nullptr;
+  }
+
+  template <class F>
+  static const char* label_of(const labelled_callable<F>& callable) {
+    return callable.label();
+  }
+
+  template <class F, class R = result_t<F>>
+  future<R> post_work_until(timer_clock::time_point deadline, F&& callable);
+
+  template <class F>
+  bool post_work_until(timer_clock::time_point deadline, F&& callable, no_future_t);
+
+  template <class Rep, class Period>
+  static timer_clock::time_point to_deadline(const std::chrono::duration<Rep, Period>& timeout) {
+    return timeout <= timeout.zero() ? timer_clock::time_point::min()
+                                     : timer_clock::now() + std::chrono::duration_cast<timer_clock::duration>(timeout);
+  }
+
+  /**
+   * Runs the callable and fulfills the promise with its result or exception.
+   */
+  template <class F, class R>
+  class promise_work {
+  public:
+    template <class G>
+    promise_work(G&& callable, promise<R> promise)
+        : callable_(std::forward<G>(callable))
+        , promise_{std::move(promise)} {
+    }
+
+    void operator()() {
+      try {
+        call_helper(std::is_void<R>{});
+      } catch (...) {
+        promise_.set_exception(std::current_exception());
+      }
+    }
+
+    void cancel() { promise_.set_exception(cancelled_exception()); }
+
+  private:
+    void call_helper(std::false_type) { promise_.set_value(callable_()); }
+
+    void call_helper(std::true_type) {
+      callable_();
+      promise_.set_value();
+    }
+
+  private:
+    F callable_;
+    promise<R> promise_;
+  };
+
+  /**
+   * Same as promise_work but only stores operation_cancelled if the token has been cancelled.
+   */
+  template <class F, class R>
+  class cancellable_promise_work {
+  public:
+    template <class G>
+    cancellable_promise_work(const cancellation_token& token, G&& callable, promise<R> promise)
+        : token_{token}
+        , work_{std::forward<G>(callable), std::move(promise)} {
+    }
+
+    void operator()() {
+      if (token_.is_cancelled()) {
+        work_.cancel();
+      } else {
+        work_();
+      }
+    }
+
+  private:
+    cancellation_token token_;
+    promise_work<F, R> work_;
+  };
+
+  /**
+   * Calls the callable unless the token has been cancelled.
+   */
+  template <class F>
+  class cancellable_work {
+  public:
+    template <class G>
+    cancellable_work(const cancellation_token& token, G&& callable)
+        : token_{token}
+        , callable_(std::forward<G>(callable)) {
+    }
+
+    void operator()() {
+      if (!token_.is_cancelled()) {
+        callable_();
+      }
+    }
+
+  private:
+    cancellation_token token_;
+    F callable_;
+  };
+
+  /**
+   * Calls the callable in a blocking_scope, see post_blocking.
+   */
+  template <class F, class R>
+  class blocking_work {
+  public:
+    template <class G>
+    blocking_work(pool& owner, G&& callable)
+        : owner_(owner)
+        , callable_(std::forward<G>(callable)) {
+    }
+
+    R operator()() {
+      blocking_scope scope(owner_);
+      return callable_();
+    }
+
+  private:
+    pool& owner_;
+    F callable_;
+  };
+
+  /**
+   * Completion counter shared by the works of a post_bulk/post_n call.
+   */
+  class bulk_state {
+  public:
+    explicit bulk_state(size_type n)
+        : remaining_{n}
+        , failed_{false} {
+    }
+
+    virtual ~bulk_state() = default;
+
+    future<void> get_future() { return promise_.get_future(); }
+
+    bool failed() const { return failed_.load(std::memory_order_relaxed); }
+
+    /**
+     * Runs callable and counts count units as done. Deletes the state once everything is done.
+     */
+    template <class F>
+    void run(F&& callable, size_type count = 1) {
+      try {
+        callable();
+      } catch (...) {
+        if (!failed_.exchange(true, std::memory_order_relaxed)) {
+          exception_ = std::current_exception();
+        }
+      }
+
+      if (remaining_.fetch_sub(count, std::memory_order_acq_rel) == count) {
+        if (failed_.load(std::memory_order_relaxed)) {
+          promise_.set_exception(exception_);
+        } else {
+          promise_.set_value();
+        }
+        delete this;
+      }
+    }
+
+  private:
+    std::atomic<size_type> remaining_;
+    std::atomic<bool> failed_;
+    std::exception_ptr exception_;
+    promise<void> promise_;
+  };
+
+  template <class F>
+  class indexed_bulk_state : public bulk_state {
+  public:
+    template <class G>
+    indexed_bulk_state(size_type n, G&& callable)
+        : bulk_state{n}
+        , callable_(std::forward<G>(callable)) {
+    }
+
+    void run(size_type i) {
+      bulk_state::run([this, i]() { callable_(i); });
+    }
+
+  private:
+    F callable_;
+  };
+
+  /**
+   * Lazily splits [lo, hi) in halves for parallel_for and parallel_reduce, see adaptive_partitioner.
+   */
+  template <class Index, class Make>
+  class adaptive_state : public bulk_state {
+  public:
+    adaptive_state(pool& owner, Make& make, size_type n, size_type grain)
+        : bulk_state{n}
+        , owner_(owner)
+        , make_(make)
+        , grain_{grain} {
+    }
+
+    /**
+     * splits is about how many ranges [lo, hi) is cut into up front. Past that a range is only split
+     * while the worker running it has nothing else queued, e.g. after it stole the range.
+     */
+    void run(Index lo, Index hi, size_type splits) {
+      while (static_cast<size_type>(hi - lo) > grain_ && (splits > 1 || owner_.local_work_count() == 0)) {
+        const Index mid = lo + (hi - lo) / 2;
+        splits /= 2;
+        owner_.post_work([this, mid, hi, splits]() { run(mid, hi, splits); }, no_future_tag);
+        hi = mid;
+      }
+
+      bulk_state::run([this, lo, hi]() {
+        auto accumulator = make_();
+        accumulator(lo, hi);
+        accumulator.flush();
+      }, static_cast<size_type>(hi - lo));
+    }
+
+  private:
+    pool& owner_;
+    Make& make_;
+    const size_type grain_;
+  };
+
+  template <class Index, class Body>
+  class for_accumulator {
+  public:
+    explicit for_accumulator(Body& body)
+        : body_(body) {
+    }
+
+    void operator()(Index lo, Index hi) {
+      for (; lo != hi; ++lo) {
+        body_(lo);
+      }
+    }
+
+    void flush() {}
+
+  private:
+    Body& body_;
+  };
+
+  template <class Index, class T, class Body, class Combine>
+  class reduce_accumulator {
+  public:
+    reduce_accumulator(const T& identity, Body& body, Combine& combine, mutex_t& mutex, T& result)
+        : value_(identity)
+        , body_(body)
+        , combine_(combine)
+        , mutex_(mutex)
+        , result_(result) {
+    }
+
+    void operator()(Index lo, Index hi) {
+      for (; lo != hi; ++lo) {
+        value_ = combine_(std::move(value_), body_(lo));
+      }
+    }
+
+    void flush() {
+      std::lock_guard<mutex_t> lock(mutex_);
+      result_ = combine_(std::move(result_), std::move(value_));
+    }
+
+  private:
+    T value_;
+    Body& body_;
+    Combine& combine_;
+    mutex_t& mutex_;
+    T& result_;
+  };
+
+  /**
+   * Runs accumulators made by make() over [begin, end) as the partitioner says and waits for them.
+   */
+  template <class Index, class Make>
+  void run_partitioned(Index begin, Index end, Make& make, const static_partitioner&);
+
+  template <class Index, class Make>
+  void run_partitioned(Index begin, Index end, Make& make, const dynamic_partitioner& partitioner);
+
+  template <class Index, class Make>
+  void run_partitioned(Index begin, Index end, Make& make, const adaptive_partitioner& partitioner);
+
+  /**
+   * \return The number of works in the calling worker's deque, 0 if not called from a worker of this pool.
+   */
+  threadpool11_EXPORT size_type local_work_count() const;
+
+  /**
+   * Runs node of a task_graph run and posts the successors that became ready.
+   */
+  void run_node(bulk_state* state, task_graph::node_data* node);
+
+  /**
+   * Reposts itself period after every run, see post_every.
+   */
+  template <class F>
+  class periodic_work {
+  public:
+    periodic_work(pool& owner, std::shared_ptr<F> callable, timer_clock::duration period,
+                  timer_clock::time_point deadline)
+        : owner_{&owner}
+        , callable_{std::move(callable)}
+        , period_{period}
+        , deadline_{deadline} {
+    }
+
+    void operator()() {
+      if (call(std::is_same<result_t<F>, bool>{})) {
+        deadline_ = std::max(deadline_ + period_, timer_clock::now());
+        pool& owner = *owner_;
+        const auto deadline = deadline_;
+        owner.add_timer(deadline, std::unique_ptr<work_t>{new work_t{work_t::type_t::STANDARD, std::move(*this)}});
+      }
+    }
+
+  private:
+    bool call(std::true_type) { return (*callable_)(); }
+
+    bool call(std::false_type) {
+      (*callable_)();
+      return true;
+    }
+
+  private:
+    pool* owner_;
+    std::shared_ptr<F> callable_;
+    timer_clock::duration period_;
+    timer_clock::time_point deadline_;
+  };
+
+  template <class Clock, class Duration>
+  static timer_clock::time_point to_timer_clock(const std::chrono::time_point<Clock, Duration>& time) {
+    return timer_clock::now() + std::chrono::duration_cast<timer_clock::duration>(time - Clock::now());
+  }
+
+  template <class Duration>
+  static timer_clock::time_point to_timer_clock(const std::chrono::time_point<timer_clock, Duration>& time) {
+    return std::chrono::time_point_cast<timer_clock::duration>(time);
+  }
+
+  /**
+   * Adds work to the timer wheel, pushes it right away if deadline has passed.
+   */
+  threadpool11_EXPORT void add_timer(timer_clock::time_point deadline, std::unique_ptr<work_t> work);
+
+  /**
+   * Pushes the works of the expired timers unless another worker is at it already.
+   */
+  void poll_timers();
+
+  threadpool11_EXPORT void push(std::unique_ptr<work_t> work, priority_t priority = priority_t::NORMAL);
+
+  /**
+   * Same as push(std::unique_ptr<work_t>, priority_t) for an EXTERNAL work, which stays with its owner.
+   */
+  threadpool11_EXPORT void push(work_t* work, priority_t priority = priority_t::NORMAL);
+
+  /**
+   * Pushes an EXTERNAL work to the queue of the calling thread's node even from a worker, so that
+   * the worker runs the works in its own deque before it gets to it again, see strand.
+   */
+  threadpool11_EXPORT void push_shared(work_t* work);
+
+  /**
+   * Enqueues all the works with a single update of the queue size and a single wakeup round.
+   */
+  threadpool11_EXPORT void push(std::vector<std::unique_ptr<work_t>> works);
+
+  /**
+   * Pushes a work to the inbox of the worker slot index modulo the slot count, see post_to.
+   */
+  threadpool11_EXPORT void push_to(size_type index, std::unique_ptr<work_t> work);
+
+  /**
+   * Maps a hash to a worker index, spread over the current worker count.
+   */
+  threadpool11_EXPORT size_type near_worker(std::size_t hash) const;
+
+  /**
+   * Brings up a compensating worker for the outermost blocking_scope of a worker of this pool.
+   *
+   * \return false if the calling thread is not a worker of this pool.
+   */
+  threadpool11_EXPORT bool begin_blocking();
+  threadpool11_EXPORT void end_blocking();
+
+  /**
+   * The number of workers the pool should run, the worker count plus one per blocked worker.
+   */
+  size_type target_worker_count() const {
+    return worker_count_.load(std::memory_order_seq_cst) + blocking_count_.load(std::memory_order_seq_cst);
+  }
+
+  /**
+   * Pushes works posted from outside the pool to the shard of the calling thread, see shard_t.
+   */
+  threadpool11_EXPORT void push_shard(work_t* work);
+  threadpool11_EXPORT void push_shard(std::vector<std::unique_ptr<work_t>> works);
+
+  /**
+   * Whether works posted by the calling thread go to a shard: NORMAL works from outside the pool
+   * while it has no capacity, bounded pools count every work on work_queue_size_.
+   */
+  bool use_shard(priority_t priority) const;
+
+  /**
+   * work_queue_size_ plus the works waiting in the shards.
+   */
+  threadpool11_EXPORT size_type queued_work_count(std::memory_order order) const;
+  threadpool11_EXPORT size_type sharded_work_count(std::memory_order order) const;
+
+  /**
+   * Reserves space for n works in the queue, waiting for it until deadline at most if the pool
+   * has a capacity. time_point::min() does not wait at all.
+   */
+  threadpool11_EXPORT bool admit(size_type n, timer_clock::time_point deadline);
+
+  /**
+   * Gives back space reserved by admit that is not going to be used.
+   */
+  threadpool11_EXPORT void retract(size_type n);
+
+  /**
+   * Same as push but the space has been reserved by admit already.
+   */
+  threadpool11_EXPORT void enqueue(std::unique_ptr<work_t> work, priority_t priority) {
+    enqueue(work.release(), priority);
+  }
+
+  /**
+   * Takes over STANDARD works, EXTERNAL ones are only pointed to. Works of a worker go to its deque
+   * unless shared is set.
+   */
+  threadpool11_EXPORT void enqueue(work_t* work, priority_t priority, bool shared = false);
+
+  /**
+   * Lets producers waiting for space know that a work has left the queue.
+   */
+  void on_dequeue();
+
+  /**
+   * The node whose queues the calling thread pushes to.
+   */
+  size_type current_node() const;
+
+  bool pop(worker& self, work_t*& work);
+  bool pop(worker& self, size_type level, work_t*& work);
+  bool pop_queue(level_t& level, size_type node, work_t*& work);
+  bool pop_remote_queues(level_t& level, size_type node, work_t*& work);
+  bool pop_shards(worker& self, size_type node, work_t*& work);
+  bool pop_remote_shards(worker& self, work_t*& work);
+  bool pop_inbox(worker& owner, work_t*& work);
+  bool steal_inbox(worker& self, work_t*& work);
+  bool steal(worker& self, bool same_node, work_t*& work);
+
+  /**
+   * Waits a bit for work according to the idle policy. idle_rounds counts the calls since the last work.
+   */
+  void wait_for_work(worker& self, size_type& idle_rounds, timer_clock::time_point wake_at);
+
+  /**
+   * Runs one work for a worker waiting for a future, see wait_helper.
+   */
+  bool help(worker& self);
+
+  /**
+   * The strand of post_keyed for a hash, the strands are created on the first call.
+   */
+  threadpool11_EXPORT strand& keyed_strand(std::size_t hash);
+
+  /**
+   * Runs a work taken off the queues and deletes it unless it is an external one.
+   */
+  void consume(worker& self, work_t* work);
+
+  void execute(worker& self, work_t& work);
+
+  /**
+   * Starts n worker threads, worker_count_ and live_worker_count_ have to be raised already.
+   */
+  void spawn(size_type n);
+
+  /**
+   * Starts the workers that were added before the pool had anything to do.
+   */
+  void start_pending();
+
+  /**
+   * Starts n workers once there is something to do, worker_count_ has to be raised already.
+   */
+  void add_pending(size_type n);
+
+  /**
+   * Wakes the workers up after worker_count_ was lowered so that the ones too many leave.
+   */
+  void release_workers(method_t method);
+
+  /**
+   * Decides whether the calling worker leaves because there are more workers than the worker count.
+   */
+  bool claim_exit();
+
+  /**
+   * Lowers the worker count for an idle worker if autoscaling allows it, then claims the exit.
+   */
+  bool retire_idle();
+
+  /**
+   * Adds a worker if autoscaling is on and works have been piling up, see autoscale_policy.
+   */
+  void maybe_grow();
+
+  /**
+   * Hands the works of a leaving worker to the others and releases its slot.
+   */
+  void exit_worker(worker& self);
+
+  /**
+   * Waits until there are no more worker threads than the worker count.
+   */
+  void wait_for_exits();
+
+  void worker_main(worker& self);
+
+public:
+  static const no_future_t no_future_tag;
+
+private:
+  /**
+   * worker_count_ is the number of workers the pool should have, live_worker_count_ the number of
+   * workers that have not claimed to leave. They differ only while workers are on their way out.
+   */
+  std::atomic<size_type> worker_count_;
+  std::atomic<size_type> live_worker_count_;
+  /**
+   * Workers in a blocking_scope, each of them is made up for by one more live worker.
+   */
+  std::atomic<size_type> blocking_count_;
+  std::shared_ptr<exit_state> exits_;
+  /**
+   * Workers counted in worker_count_ that have not been started yet, see start_pending.
+   */
+  std::atomic<size_type> pending_workers_;
+  std::atomic<bool> started_;
+
+  std::atomic<bool> autoscale_;
+  std::atomic<size_type> autoscale_min_;
+  std::atomic<size_type> autoscale_max_;
+  std::atomic<size_type> autoscale_queue_depth_;
+  std::atomic<timer_clock::rep> autoscale_keep_alive_;
+  std::atomic<timer_clock::rep> autoscale_delay_;
+  /**
+   * Since when works have been piling up, 0 if they are not.
+   */
+  std::atomic<timer_clock::rep> pressure_since_;
+
+  event_count work_signal_;
+  std::atomic<size_type> idle_spin_count_;
+  std::atomic<size_type> idle_yield_count_;
+  std::atomic<timer_clock::rep> inbox_steal_delay_;
+
+  const threadpool11::placement placement_;
+  const size_type node_count_;
+
+  /**
+   * Queues of a priority level, one per node. size also counts the works of that level sitting in
+   * worker deques.
+   */
+  struct level_t {
+    level_t()
+        : size{0} {
+    }
+
+    std::vector<std::unique_ptr<queue_t>> queues;
+    std::atomic<size_type> size;
+  };
+
+  level_t levels_[priority_count];
+
+  /**
+   * Queue for the NORMAL works posted from outside the pool. Every node has shards_per_node_ of them
+   * and producer threads are spread over the shards of their node, so that producers do not contend
+   * on the same queue and counter. The counters are kept on cache lines of their own.
+   */
+  struct shard_t {
+    shard_t()
+        : queue(0)
+        , size{0} {
+    }
+
+    queue_t queue;
+    char front_padding[64];
+    std::atomic<size_type> size;
+    char back_padding[64];
+  };
+
+  const size_type shards_per_node_;
+  std::vector<std::unique_ptr<shard_t>> shards_;
+  std::once_flag keyed_strands_created_;
+  std::vector<std::unique_ptr<strand>> keyed_strands_;
+
+  std::atomic<size_type> work_queue_size_;
+
+  /**
+   * Works in the inboxes of the workers, they are counted on work_queue_size_ too.
+   */
+  std::atomic<size_type> inbox_work_count_;
+
+  std::atomic<size_type> capacity_;
+  event_count space_signal_;
+
+  std::unique_ptr<worker_table> workers_;
+
+  mutex_t timer_mutex_;
+  timer_wheel timers_;
+  std::atomic<size_type> timer_count_;
+  /**
+   * timers_.next_expiry() since the clock's epoch, so that workers can check it without the lock.
+   */
+  std::atomic<timer_clock::rep> next_timer_;
+
+  static thread_local worker* current_worker_;
+};
+
+template <class F, class R>
+threadpool11_EXPORT inline future<R> pool::post_work(work_t::type_t type, priority_t priority, F&& callable,
+                                                     const char* label) {
+  promise<R> promise;
+  auto future = promise.get_future();
+
+  std::unique_ptr<work_t> work{new work_t{
+      std::move(type), promise_work<typename std::decay<F>::type, R>{std::forward<F>(callable), std::move(promise)}}};
+  work->set_label(label);
+
+  push(std::move(work), priority);
+
+  return future;
+}
+
+template <class F>
+threadpool11_EXPORT inline void pool::post_work(work_t::type_t type, priority_t priority, F&& callable,
+                                                no_future_t, const char* label) {
+  std::unique_ptr<work_t> work{new work_t{std::move(type), std::forward<F>(callable)}};
+  work->set_label(label);
+
+  push(std::move(work), priority);
+}
+
+template <class F, class R>
+threadpool11_EXPORT inline future<R> pool::post_work(priority_t priority, const cancellation_token& token,
+                                                     F&& callable) {
+  promise<R> promise;
+  auto future = promise.get_future();
+
+  const char* const label = label_of(callable);
+  std::unique_ptr<work_t> work{new work_t{
+      work_t::type_t::STANDARD,
+      cancellable_promise_work<typename std::decay<F>::type, R>{token, std::forward<F>(callable), std::move(promise)}}};
+  work->set_label(label);
+
+  push(std::move(work), priority);
+
+  return future;
+}
+
+template <class F, class>
+threadpool11_EXPORT inline void pool::post_work(priority_t priority, const cancellation_token& token, F&& callable,
+                                                no_future_t) {
+  const char* const label = label_of(callable);
+  std::unique_ptr<work_t> work{new work_t{
+      work_t::type_t::STANDARD, cancellable_work<typename std::decay<F>::type>{token, std::forward<F>(callable)}}};
+  work->set_label(label);
+
+  push(std::move(work), priority);
+}
+
+template <class F, class R>
+threadpool11_EXPORT inline future<R> pool::post_to(size_type worker_index, F&& callable) {
+  promise<R> promise;
+  auto future = promise.get_future();
+
+  const char* const label = label_of(callable);
+  std::unique_ptr<work_t> work{new work_t{work_t::type_t::STANDARD, promise_work<typename std::decay<F>::type, R>{
+                                                                        std::forward<F>(callable), std::move(promise)}}};
+  work->set_label(label);
+
+  push_to(worker_index, std::move(work));
+
+  return future;
+}
+
+template <class F, class>
+threadpool11_EXPORT inline void pool::post_to(size_type worker_index, F&& callable, no_future_t) {
+  const char* const label = label_of(callable);
+  std::unique_ptr<work_t> work{new work_t{work_t::type_t::STANDARD, std::forward<F>(callable)}};
+  work->set_label(label);
+
+  push_to(worker_index, std::move(work));
+}
+
+template <class F, class R>
+inline future<R> pool::post_work_until(timer_clock::time_point deadline, F&& callable) {
+  if (!admit(1, deadline)) {
+    return future<R>();
+  }
+
+  promise<R> promise;
+  auto future = promise.get_future();
+
+  std::unique_ptr<work_t> work;
+  try {
+    work.reset(new work_t{work_t::type_t::STANDARD, promise_work<typename std::decay<F>::type, R>{
+                                                        std::forward<F>(callable), std::move(promise)}});
+  } catch (...) {
+    retract(1);
+    throw;
+  }
+  enqueue(std::move(work), priority_t::NORMAL);
+
+  return future;
+}
+
+template <class F>
+inline bool pool::post_work_until(timer_clock::time_point deadline, F&& callable, no_future_t) {
+  if (!admit(1, deadline)) {
+    return false;
+  }
+
+  std::unique_ptr<work_t> work;
+  try {
+    work.reset(new work_t{work_t::type_t::STANDARD, std::forward<F>(callable)});
+  } catch (...) {
+    retract(1);
+    throw;
+  }
+  enqueue(std::move(work), priority_t::NORMAL);
+
+  return true;
+}
+
+template <class Iterator>
+threadpool11_EXPORT inline future<void> pool::post_bulk(Iterator first, Iterator last) {
+  using callable_type = typename std::decay<decltype(*first)>::type;
+
+  const size_type n = static_cast<size_type>(std::distance(first, last));
+  if (n == 0) {
+    promise<void> promise;
+    promise.set_value();
+    return promise.get_future();
+  }
+
+  std::unique_ptr<bulk_state> state{new bulk_state{n}};
+  auto future = state->get_future();
+
+  struct bulk_work {
+    bulk_state* state;
+    callable_type callable;
+
+    void operator()() { state->run(callable); }
+  };
+
+  std::vector<std::unique_ptr<work_t>> works;
+  works.reserve(n);
+  for (; first != last; ++first) {
+    works.emplace_back(new work_t{work_t::type_t::STANDARD, bulk_work{state.get(), *first}});
+  }
+
+  state.release();
+  push(std::move(works));
+
+  return future;
+}
+
+template <class F>
+threadpool11_EXPORT inline future<void> pool::post_n(size_type n, F&& callable) {
+  using state_type = indexed_bulk_state<typename std::decay<F>::type>;
+
+  if (n == 0) {
+    promise<void> promise;
+    promise.set_value();
+    return promise.get_future();
+  }
+
+  std::unique_ptr<state_type> state{new state_type{n, std::forward<F>(callable)}};
+  auto future = state->get_future();
+
+  std::vector<std::unique_ptr<work_t>> works;
+  works.reserve(n);
+  for (size_type i = 0; i < n; ++i) {
+    state_type* const s = state.get();
+    works.emplace_back(new work_t{work_t::type_t::STANDARD, [s, i]() { s->run(i); }});
+  }
+
+  state.release();
+  push(std::move(works));
+
+  return future;
+}
+
+template <class Clock, class Duration, class F, class R>
+threadpool11_EXPORT inline future<R> pool::post_at(const std::chrono::time_point<Clock, Duration>& deadline,
+                                                   F&& callable) {
+  promise<R> promise;
+  auto future = promise.get_future();
+
+  add_timer(to_timer_clock(deadline),
+           std::unique_ptr<work_t>{new work_t{work_t::type_t::STANDARD,
+                                              promise_work<typename std::decay<F>::type, R>{
+                                                  std::forward<F>(callable), std::move(promise)}}});
+
+  return future;
+}
+
+template <class Clock, class Duration, class F, class>
+threadpool11_EXPORT inline void pool::post_at(const std::chrono::time_point<Clock, Duration>& deadline,
+                                              F&& callable, no_future_t) {
+  add_timer(to_timer_clock(deadline),
+           std::unique_ptr<work_t>{new work_t{work_t::type_t::STANDARD, std::forward<F>(callable)}});
+}
+
+template <class Rep, class Period, class F>
+threadpool11_EXPORT inline void pool::post_every(const std::chrono::duration<Rep, Period>& period, F&& callable) {
+  using callable_type = typename std::decay<F>::type;
+
+  const auto interval = std::chrono::duration_cast<timer_clock::duration>(period);
+  if (interval <= timer_clock::duration::zero()) {
+    throw std::invalid_argument("threadpool11::pool::post_every: period must be positive");
+  }
+
+  const auto deadline = timer_clock::now() + interval;
+  add_timer(deadline, std::unique_ptr<work_t>{new work_t{
+                         work_t::type_t::STANDARD,
+                         periodic_work<callable_type>{*this, std::make_shared<callable_type>(std::forward<F>(callable)),
+                                                      interval, deadline}}});
+}
+
+template <class Index, class Body, class Partitioner>
+threadpool11_EXPORT inline void pool::parallel_for(Index begin, Index end, Body&& body,
+                                                   const Partitioner& partitioner) {
+  using body_type = typename std::remove_reference<Body>::type;
+
+  auto make = [&body]() { return for_accumulator<Index, body_type>{body}; };
+  run_partitioned(begin, end, make, partitioner);
+}
+
+template <class Index, class T, class Body, class Combine, class Partitioner>
+threadpool11_EXPORT inline T pool::parallel_reduce(Index begin, Index end, T identity, Body&& body,
+                                                   Combine&& combine, const Partitioner& partitioner) {
+  using accumulator_type = reduce_accumulator<Index, T, typename std::remove_reference<Body>::type,
+                                              typename std::remove_reference<Combine>::type>;
+
+  mutex_t mutex;
+  T result = identity;
+
+  auto make = [&]() { return accumulator_type{identity, body, combine, mutex, result}; };
+  run_partitioned(begin, end, make, partitioner);
+
+  return result;
+}
+
+template <class Index, class Make>
+inline void pool::run_partitioned(Index begin, Index end, Make& make, const static_partitioner&) {
+  if (!(begin < end)) {
+    return;
+  }
+
+  const size_type n = static_cast<size_type>(end - begin);
+  const size_type tasks = std::min(n, std::max<size_type>(1, get_worker_count()));
+  const size_type block = n / tasks;
+  const size_type remainder = n % tasks;
+
+  post_n(tasks, [begin, block, remainder, &make](size_type k) {
+    const size_type lo = k * block + std::min(k, remainder);
+    const size_type hi = lo + block + (k < remainder ? 1 : 0);
+
+    auto accumulator = make();
+    accumulator(begin + static_cast<Index>(lo), begin + static_cast<Index>(hi));
+    accumulator.flush();
+  }).get();
+}
+
+template <class Index, class Make>
+inline void pool::run_partitioned(Index begin, Index end, Make& make, const dynamic_partitioner& partitioner) {
+  if (!(begin < end)) {
+    return;
+  }
+
+  const size_type n = static_cast<size_type>(end - begin);
+  const size_type chunk = partitioner.chunk();
+  const size_type tasks = std::min((n + chunk - 1) / chunk, std::max<size_type>(1, get_worker_count()));
+  std::atomic<size_type> next{0};
+
+  post_n(tasks, [begin, n, chunk, &next, &make](size_type) {
+    auto accumulator = make();
+    for (size_type lo; (lo = next.fetch_add(chunk, std::memory_order_relaxed)) < n;) {
+      accumulator(begin + static_cast<Index>(lo), begin + static_cast<Index>(std::min(lo + chunk, n)));
+    }
+    accumulator.flush();
+  }).get();
+}
+
+template <class Index, class Make>
+inline void pool::run_partitioned(Index begin, Index end, Make& make, const adaptive_partitioner& partitioner) {
+  if (!(begin < end)) {
+    return;
+  }
+
+  using state_type = adaptive_state<Index, Make>;
+
+  const size_type n = static_cast<size_type>(end - begin);
+  std::unique_ptr<state_type> state{new state_type{*this, make, n, partitioner.grain()}};
+  auto future = state->get_future();
+
+  // owned by the works from here on, the last one to finish deletes it
+  state_type* const running = state.get();
+  const size_type splits =
+      adaptive_partitioner::splits_per_worker * std::max<size_type>(1, get_worker_count());
+  post_work([running, begin, end, splits]() { running->run(begin, end, splits); }, no_future_tag);
+  state.release();
+
+  future.get();
+}
+
+#undef threadpool11_EXPORT
+#undef threadpool11_EXPORTING
+}
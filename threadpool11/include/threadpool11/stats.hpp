@@ -0,0 +1,140 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace threadpool11 {
+
+/**
+ * \brief Histogram of durations with power of two buckets.
+ *
+ * Bucket 0 counts zero durations, bucket i counts durations in [2^(i-1), 2^i) nanoseconds.
+ * The last bucket also counts everything longer.
+ */
+class latency_histogram {
+public:
+  using size_type = std::size_t;
+
+  static constexpr size_type bucket_count = 48;
+
+public:
+  latency_histogram() { buckets_.fill(0); }
+
+  static size_type bucket_of(std::uint64_t nanoseconds) {
+    size_type bucket = 0;
+    while (nanoseconds != 0 && bucket + 1 < bucket_count) {
+      nanoseconds >>= 1;
+      ++bucket;
+    }
+    return bucket;
+  }
+
+  /**
+   * \return The exclusive upper bound of the durations counted in bucket.
+   */
+  static std::chrono::nanoseconds upper_bound(size_type bucket) {
+    return std::chrono::nanoseconds(static_cast<std::chrono::nanoseconds::rep>(std::uint64_t{1} << bucket));
+  }
+
+  void add(size_type bucket, std::uint64_t count) { buckets_[bucket] += count; }
+
+  std::uint64_t bucket(size_type bucket) const { return buckets_[bucket]; }
+
+  std::uint64_t count() const {
+    std::uint64_t n = 0;
+    for (const auto count : buckets_) {
+      n += count;
+    }
+    return n;
+  }
+
+  /**
+   * \return The upper bound of the bucket the p'th fraction of the durations fall in, p is in [0, 1].
+   */
+  std::chrono::nanoseconds percentile(double p) const {
+    const std::uint64_t total = count();
+    if (total == 0) {
+      return std::chrono::nanoseconds::zero();
+    }
+
+    const auto rank = static_cast<std::uint64_t>(p * static_cast<double>(total - 1));
+    std::uint64_t seen = 0;
+    for (size_type i = 0; i < bucket_count; ++i) {
+      seen += buckets_[i];
+      if (seen > rank) {
+        return upper_bound(i);
+      }
+    }
+    return upper_bound(bucket_count - 1);
+  }
+
+  latency_histogram& operator+=(const latency_histogram& other) {
+    for (size_type i = 0; i < bucket_count; ++i) {
+      buckets_[i] += other.buckets_[i];
+    }
+    return *this;
+  }
+
+private:
+  std::array<std::uint64_t, bucket_count> buckets_;
+};
+
+/**
+ * \brief Counters of a worker slot since the pool was created, see pool::snapshot.
+ *
+ * Idle time is spent spinning and yielding while looking for work, parked time
+ * is spent asleep. Busy time does not count works run by a worker that waits
+ * for a future twice.
+ */
+struct worker_stats {
+  std::size_t index;
+  std::size_t node;
+  bool active;
+
+  std::uint64_t tasks_executed;
+  std::uint64_t steals;
+  std::uint64_t parks;
+
+  std::chrono::nanoseconds busy_time;
+  std::chrono::nanoseconds idle_time;
+  std::chrono::nanoseconds parked_time;
+};
+
+/**
+ * \brief Statistics of a pool, see pool::snapshot.
+ */
+struct pool_stats {
+  std::vector<worker_stats> workers;
+
+  /**
+   * Time from posting a work until a worker starts running it.
+   */
+  latency_histogram queue_latency;
+
+  /**
+   * Time a work takes to run.
+   */
+  latency_histogram run_time;
+};
+
+/**
+ * \brief A work run by a worker, see pool::trace.
+ *
+ * Times are steady clock nanoseconds since its epoch. A stolen work was taken from the deque
+ * or the inbox of another worker, the others were posted by the worker itself or taken from
+ * the shared queues.
+ */
+struct trace_event {
+  const char* label;
+  std::size_t worker;
+  bool stolen;
+
+  std::uint64_t enqueue_time;
+  std::uint64_t start_time;
+  std::uint64_t end_time;
+};
+
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+#include "allocator.hpp"
+#include "futex.hpp"
+#include "pool.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+namespace threadpool11 {
+
+/**
+ * \brief Runs its works one at a time and in the order they are posted, on the workers of a pool.
+ *
+ * Works are kept in a lock-free intrusive queue. The first work posted to an idle strand
+ * posts the strand itself to the pool, the worker picking it up then runs the strand's works
+ * back to back until there are none left. Works posted meanwhile are run by that same worker
+ * without another trip through the pool. After batch_size works the strand goes to the back
+ * of the pool's shared queue, not to the worker's own deque, so that it does not hog the worker.
+ *
+ * The work that runs a strand lives in the strand, so a busy strand costs one allocation per
+ * work like a plain post does. A strand must not be destroyed while it still has works.
+ *
+ * Properties: thread-safe.
+ */
+class pool::strand {
+public:
+  static constexpr size_type batch_size = 64;
+
+public:
+  explicit strand(pool& pool)
+      : pool_(pool)
+      , head_{&stub_}
+      , tail_{&stub_}
+      , pending_{0}
+      , drain_work_{work_t::type_t::EXTERNAL, drainer{this}} {
+  }
+
+  ~strand() { assert(pending_.load(std::memory_order_relaxed) == 0); }
+
+  strand(const strand&) = delete;
+  strand& operator=(const strand&) = delete;
+
+  /**
+   * \brief post Same as pool::post_work(F&&) but the work runs after all works posted to the strand before it.
+   */
+  template <class F, class R = result_t<F>>
+  future<R> post(F&& callable) {
+    promise<R> promise;
+    auto future = promise.get_future();
+    enqueue(new callable_node<promise_work<typename std::decay<F>::type, R>>{std::forward<F>(callable),
+                                                                              std::move(promise)});
+    return future;
+  }
+
+  /**
+   * Same as post(F&&) except does not have the overhead of futures.
+   */
+  template <class F, class = result_t<F>>
+  void post(F&& callable, no_future_t) {
+    enqueue(new callable_node<typename std::decay<F>::type>{std::forward<F>(callable)});
+  }
+
+  /**
+   * \return Whether the calling thread is running a work of this strand.
+   */
+  bool running_in_this_thread() const { return current() == this; }
+
+private:
+  struct node {
+    node()
+        : next{nullptr} {
+    }
+
+    virtual ~node() = default;
+
+    virtual void run() {}
+
+    std::atomic<node*> next;
+  };
+
+  template <class F>
+  struct callable_node : node {
+    template <class... Args>
+    explicit callable_node(Args&&... args)
+        : callable(std::forward<Args>(args)...) {
+    }
+
+    void run() override { callable(); }
+
+    static void* operator new(std::size_t size) { return small_object_allocator::allocate(size); }
+    static void operator delete(void* ptr, std::size_t size) { small_object_allocator::deallocate(ptr, size); }
+
+    F callable;
+  };
+
+  struct drainer {
+    void operator()() const { owner->drain(); }
+
+    strand* owner;
+  };
+
+private:
+  static const strand*& current() {
+    static thread_local const strand* current = nullptr;
+    return current;
+  }
+
+  void enqueue(node* n) {
+    push(n);
+    // the first work of an idle strand schedules it, the running strand picks up the rest
+    if (pending_.fetch_add(1, std::memory_order_acq_rel) == 0) {
+      pool_.push(&drain_work_);
+    }
+  }
+
+  /**
+   * Multiple producer side of the queue.
+   */
+  void push(node* n) {
+    n->next.store(nullptr, std::memory_order_relaxed);
+    node* const previous = head_.exchange(n, std::memory_order_acq_rel);
+    previous->next.store(n, std::memory_order_release);
+  }
+
+  /**
+   * Single consumer side of the queue, nullptr if the next node is not linked in yet.
+   */
+  node* pop() {
+    node* tail = tail_;
+    node* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+      if (next == nullptr) {
+        return nullptr;
+      }
+      tail_ = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next != nullptr) {
+      tail_ = next;
+      return tail;
+    }
+    if (tail != head_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    // tail is the last node, put the stub behind it so that it can be handed out
+    push(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next != nullptr) {
+      tail_ = next;
+      return tail;
+    }
+    return nullptr;
+  }
+
+  void drain() {
+    const strand* const previous = current();
+    current() = this;
+
+    for (size_type i = 0; i < batch_size; ++i) {
+      // pending_ says there is a node, its producer may just not have linked it in yet
+      node* n;
+      while ((n = pop()) == nullptr) {
+        cpu_relax();
+      }
+      std::unique_ptr<node> owned(n);
+      owned->run();
+      owned.reset();
+
+      if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        current() = previous;
+        return;
+      }
+    }
+
+    current() = previous;
+    // the strand may be picked up by another worker right away, nothing may be touched after this
+    pool_.push_shared(&drain_work_);
+  }
+
+private:
+  pool& pool_;
+  node stub_;
+  std::atomic<node*> head_;
+  node* tail_;
+  std::atomic<size_type> pending_;
+  work_t drain_work_;
+};
+
+template <class Key, class F, class R>
+inline future<R> pool::post_keyed(const Key& key, F&& callable) {
+  return keyed_strand(std::hash<Key>()(key)).post(std::forward<F>(callable));
+}
+
+template <class Key, class F, class>
+inline void pool::post_keyed(const Key& key, F&& callable, no_future_t) {
+  keyed_strand(std::hash<Key>()(key)).post(std::forward<F>(callable), no_future_tag);
+}
+
+}
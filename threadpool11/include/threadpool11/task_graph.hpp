@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace threadpool11 {
+
+class pool;
+
+/**
+ * \brief A set of works with dependencies between them, run by pool::run.
+ *
+ * A work is started once all of the works it succeeds have finished, by the
+ * worker that finishes the last of them. Nobody blocks while the graph runs.
+ *
+ *   task_graph graph;
+ *   auto load = graph.emplace([]() { ... });
+ *   auto parse = graph.emplace([]() { ... });
+ *   load.precede(parse);
+ *   pool.run(graph).get();
+ *
+ * A graph can be run any number of times, but not while it is already running.
+ *
+ * Properties: NOT thread-safe.
+ */
+class task_graph {
+private:
+  struct node_data;
+
+public:
+  using size_type = std::size_t;
+
+  /**
+   * \brief Handle of a work in a task_graph. Stays valid as long as the graph does.
+   */
+  class node {
+  public:
+    /**
+     * Makes other wait for this node to finish.
+     */
+    node& precede(node other) {
+      data_->successors.push_back(other.data_);
+      ++other.data_->predecessor_count;
+      return *this;
+    }
+
+    /**
+     * Makes this node wait for other to finish.
+     */
+    node& succeed(node other) {
+      other.precede(*this);
+      return *this;
+    }
+
+  private:
+    friend class task_graph;
+
+    explicit node(node_data* data)
+        : data_{data} {
+    }
+
+  private:
+    node_data* data_;
+  };
+
+public:
+  task_graph() = default;
+
+  task_graph(const task_graph&) = delete;
+  task_graph& operator=(const task_graph&) = delete;
+
+  template <class F>
+  node emplace(F&& callable) {
+    nodes_.emplace_back(new node_data{std::forward<F>(callable)});
+    return node{nodes_.back().get()};
+  }
+
+  size_type size() const { return nodes_.size(); }
+  bool empty() const { return nodes_.empty(); }
+
+private:
+  friend class pool;
+
+  struct node_data {
+    template <class F>
+    explicit node_data(F&& callable)
+        : callable(std::forward<F>(callable))
+        , predecessor_count{0}
+        , pending{0} {
+    }
+
+    std::function<void()> callable;
+    std::vector<node_data*> successors;
+    size_type predecessor_count;
+    std::atomic<size_type> pending;
+  };
+
+private:
+  std::vector<std::unique_ptr<node_data>> nodes_;
+};
+
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "future.hpp"
+#include "futex.hpp"
+#include "pool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+namespace threadpool11 {
+
+/**
+ * \brief Works posted to a pool that are waited for all together.
+ *
+ * Keeps one count of the works that have not finished instead of a future per work, so
+ * a work costs as much as one posted with pool::no_future_tag.
+ *
+ *   task_group group(pool);
+ *   for (...) {
+ *     group.run([]() { ... });
+ *   }
+ *   group.wait();
+ *
+ * Once a work throws, the works of the group that have not started yet are skipped and wait
+ * rethrows the first exception. The group can be used again after wait returns. The destructor
+ * waits for the works as well but drops their exception.
+ *
+ * Properties: thread-safe.
+ */
+class task_group {
+public:
+  using size_type = std::size_t;
+
+public:
+  explicit task_group(pool& owner)
+      : pool_(owner)
+      , state_{0}
+      , failed_{false} {
+  }
+
+  ~task_group() {
+    try {
+      wait();
+    } catch (...) {
+    }
+  }
+
+  task_group(const task_group&) = delete;
+  task_group& operator=(const task_group&) = delete;
+
+  /**
+   * \brief Posts callable to the pool as a work of the group.
+   */
+  template <class F>
+  void run(F&& callable) {
+    state_.fetch_add(1, std::memory_order_relaxed);
+    try {
+      pool_.post_work(group_work<typename std::decay<F>::type>{*this, std::forward<F>(callable)},
+                      pool::no_future_tag);
+    } catch (...) {
+      finish();
+      throw;
+    }
+  }
+
+  /**
+   * \brief Blocks until every work run so far has finished. Rethrows the first exception of them.
+   *
+   * On a pool worker it runs other works of the pool meanwhile instead, see wait_helper,
+   * so works can wait for the groups they run.
+   */
+  void wait() {
+    // spins and parks like a future does
+    using timing = future_state<void>;
+    wait_helper* const helper = wait_helper::current();
+
+    unsigned idle_rounds = 0;
+    std::uint32_t state = state_.load(std::memory_order_acquire);
+    while ((state & count_mask) != 0) {
+      if (helper != nullptr && helper->help()) {
+        idle_rounds = 0;
+      } else if (++idle_rounds < timing::spin_count) {
+        cpu_relax();
+      } else if ((state & WAITING) != 0 ||
+                 state_.compare_exchange_weak(state, state | WAITING, std::memory_order_acquire)) {
+        // a helper only blocks for a while, works posted meanwhile are picked up after
+        if (helper != nullptr) {
+          futex_wait_for(state_, state | WAITING, timing::help_park_time);
+        } else {
+          futex_wait(state_, state | WAITING);
+        }
+      }
+      state = state_.load(std::memory_order_acquire);
+    }
+    // unless the group has been reused meanwhile
+    if (state == WAITING) {
+      state_.compare_exchange_strong(state, 0, std::memory_order_relaxed);
+    }
+
+    if (failed_.load(std::memory_order_acquire)) {
+      std::exception_ptr exception = std::move(exception_);
+      failed_.store(false, std::memory_order_relaxed);
+      std::rethrow_exception(exception);
+    }
+  }
+
+  /**
+   * \return The number of works of the group that have not finished.
+   */
+  size_type outstanding() const { return state_.load(std::memory_order_relaxed) & count_mask; }
+
+private:
+  /**
+   * The low bits count the works that have not finished, WAITING is set once somebody blocks.
+   */
+  enum : std::uint32_t {
+    WAITING = std::uint32_t{1} << 31,
+  };
+  static constexpr std::uint32_t count_mask = WAITING - 1;
+
+  template <class F>
+  class group_work {
+  public:
+    template <class G>
+    group_work(task_group& group, G&& callable)
+        : group_(&group)
+        , callable_(std::forward<G>(callable)) {
+    }
+
+    void operator()() {
+      if (!group_->failed_.load(std::memory_order_relaxed)) {
+        try {
+          callable_();
+        } catch (...) {
+          group_->fail(std::current_exception());
+        }
+      }
+      group_->finish();
+    }
+
+  private:
+    task_group* group_;
+    F callable_;
+  };
+
+  void fail(std::exception_ptr exception) {
+    bool failed = false;
+    // the first one keeps the exception, it is read once the count drops to zero
+    if (!failed_.load(std::memory_order_relaxed) &&
+        failed_.compare_exchange_strong(failed, true, std::memory_order_relaxed)) {
+      exception_ = std::move(exception);
+    }
+  }
+
+  void finish() {
+    // the waiter may return and destroy the group as soon as the count drops, only the address
+    // of the word is used after that, futex_wake does not touch the memory
+    const std::uint32_t old = state_.fetch_sub(1, std::memory_order_acq_rel);
+    if ((old & count_mask) == 1 && (old & WAITING) != 0) {
+      futex_wake(state_, std::numeric_limits<std::uint32_t>::max());
+    }
+  }
+
+private:
+  pool& pool_;
+  std::atomic<std::uint32_t> state_;
+  std::atomic<bool> failed_;
+  std::exception_ptr exception_;
+};
+
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#if defined(WIN32) && defined(threadpool11_DLL)
+#ifdef threadpool11_EXPORTING
+#define threadpool11_EXPORT __declspec(dllexport)
+#else
+#define threadpool11_EXPORT __declspec(dllimport)
+#endif
+#else
+#define threadpool11_EXPORT
+#endif
+
+namespace threadpool11 {
+
+/**
+ * \brief Process-wide cache of idle threads, pools start their workers through it.
+ *
+ * A thread that is done with its task waits in the cache for keep alive time
+ * before it ends, so that pools created and destroyed in quick succession reuse
+ * the same threads instead of creating new ones.
+ *
+ * Properties: thread-safe.
+ */
+class thread_cache {
+public:
+  using size_type = std::size_t;
+
+public:
+  thread_cache(const thread_cache&) = delete;
+  thread_cache& operator=(const thread_cache&) = delete;
+
+  /**
+   * \return The cache of the process, it is never destroyed so that cached threads can outlive main.
+   */
+  threadpool11_EXPORT static thread_cache& get();
+
+  /**
+   * \brief run Runs task on an idle thread, or on a new detached thread if there is none.
+   */
+  threadpool11_EXPORT void run(std::function<void()> task);
+
+  /**
+   * \return The number of threads waiting in the cache.
+   */
+  threadpool11_EXPORT size_type idle_count() const;
+
+  /**
+   * \brief set_keep_alive Sets how long a thread waits in the cache for a new task, 5 seconds by default.
+   *
+   * Threads already waiting keep their current deadline.
+   */
+  threadpool11_EXPORT void set_keep_alive(std::chrono::milliseconds keep_alive);
+
+  threadpool11_EXPORT std::chrono::milliseconds get_keep_alive() const;
+
+private:
+  struct idle_thread;
+
+  using mutex_t = std::mutex;
+
+private:
+  thread_cache();
+
+  void thread_main(std::function<void()> task);
+
+private:
+  mutable mutex_t mutex_;
+  std::vector<idle_thread*> idle_;
+  std::atomic<std::chrono::milliseconds::rep> keep_alive_;
+};
+
+}
+
+#undef threadpool11_EXPORT
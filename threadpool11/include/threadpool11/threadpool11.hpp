@@ -1,4 +1,8 @@
-﻿#pragma once
-
-#include "pool.hpp"
-
+﻿#pragma once
+
+#include "algorithm.hpp"
+#include "coroutine.hpp"
+#include "pool.hpp"
+#include "strand.hpp"
+#include "task_group.hpp"
+
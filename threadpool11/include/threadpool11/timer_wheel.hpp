@@ -0,0 +1,109 @@
+#pragma once
+
+#include "allocator.hpp"
+#include "work.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#if defined(WIN32) && defined(threadpool11_DLL)
+#ifdef threadpool11_EXPORTING
+#define threadpool11_EXPORT __declspec(dllexport)
+#else
+#define threadpool11_EXPORT __declspec(dllimport)
+#endif
+#else
+#define threadpool11_EXPORT
+#endif
+
+namespace threadpool11 {
+
+/**
+ * \brief Hierarchical timer wheel holding works until their deadline.
+ *
+ * Time is cut into ticks of 'resolution'. There are level_count levels of
+ * slot_count slots, a slot of level n spans slot_count^n ticks. Adding a timer
+ * is O(1), a timer is moved down a level at most level_count - 1 times before
+ * it expires. Timers further away than the top level are parked in its last
+ * slot and re-sorted when it is reached.
+ *
+ * A timer never expires before its deadline, and expires at most a tick after
+ * it provided advance is called often enough.
+ *
+ * Properties: NOT thread-safe.
+ */
+class timer_wheel {
+public:
+  using clock = std::chrono::steady_clock;
+  using resolution = std::chrono::milliseconds;
+  using size_type = std::size_t;
+
+  static constexpr unsigned slot_bits = 6;
+  static constexpr size_type slot_count = size_type{1} << slot_bits;
+  static constexpr size_type level_count = 4;
+
+public:
+  threadpool11_EXPORT explicit timer_wheel(clock::time_point origin = clock::now());
+  threadpool11_EXPORT ~timer_wheel();
+
+  timer_wheel(const timer_wheel&) = delete;
+  timer_wheel& operator=(const timer_wheel&) = delete;
+
+  /**
+   * Adds task to expire at deadline. Deadlines up to the last advance expire on the next tick.
+   */
+  threadpool11_EXPORT void add(clock::time_point deadline, std::unique_ptr<work> task);
+
+  /**
+   * Moves the time forward to now and appends the tasks that expired to expired.
+   */
+  threadpool11_EXPORT void advance(clock::time_point now, std::vector<std::unique_ptr<work>>& expired);
+
+  /**
+   * \return A time no later than the earliest deadline, when advance has to be called next.
+   *  clock::time_point::max() if the wheel is empty.
+   */
+  threadpool11_EXPORT clock::time_point next_expiry() const;
+
+  size_type size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+private:
+  using tick_type = std::uint64_t;
+
+  struct entry {
+    entry* next;
+    tick_type tick;
+    std::unique_ptr<work> task;
+
+    static void* operator new(std::size_t size) { return small_object_allocator::allocate(size); }
+    static void operator delete(void* ptr, std::size_t size) { small_object_allocator::deallocate(ptr, size); }
+  };
+
+private:
+  /**
+   * Puts e in the slot for its tick, which must not be before now_tick_.
+   */
+  void insert(entry* e);
+
+  /**
+   * Re-inserts the timers of a slot of a higher level, they end up in lower levels.
+   */
+  void cascade(size_type level);
+
+  tick_type compute_next_tick() const;
+
+private:
+  const clock::time_point origin_;
+  tick_type now_tick_;
+  tick_type next_tick_;
+  size_type size_;
+  entry* slots_[level_count][slot_count];
+};
+
+}
+
+#undef threadpool11_EXPORT
@@ -1,38 +1,174 @@
 #pragma once
 
-#include <functional>
+#include "allocator.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// works carry the time they were posted at for statistics and traces
+#if defined(threadpool11_STATS) || defined(threadpool11_TRACE)
+#define threadpool11_ENQUEUE_TIME
+#endif
 
 namespace threadpool11 {
 
+/**
+ * \brief A move-only, type-erased unit of work.
+ *
+ * Callables up to storage_size bytes that are nothrow move constructible are
+ * stored inline, bigger ones are put on the heap. work objects themselves come
+ * from small_object_allocator, so posting a small lambda does not touch the
+ * global allocator once its caches are warm.
+ */
 class work {
 public:
-  using callable_t = std::function<void()>;
-
+  /**
+   * STANDARD works are owned by the pool and deleted once they have run.
+   * EXTERNAL works belong to whoever posted them, e.g. a coroutine frame, and may
+   * be gone as soon as they have run, see schedule_awaiter.
+   */
   enum class type_t {
     STANDARD,
-    TERMINAL,
+    EXTERNAL,
   };
 
+#if defined(threadpool11_TRACE)
+  // keeps the work at 64 bytes next to the enqueue time and the label
+  static constexpr std::size_t storage_size = 32;
+#elif defined(threadpool11_STATS)
+  // keeps the work at 64 bytes next to the enqueue time
+  static constexpr std::size_t storage_size = 40;
+#else
+  static constexpr std::size_t storage_size = 48;
+#endif
+
 public:
-  work(type_t type, callable_t callable)
-    : type_{std::move(type)}
-    , callable_{std::move(callable)} {
+  template <class F>
+  work(type_t type, F&& callable)
+      : ops_{&ops_for<typename std::decay<F>::type>::ops}
+      , type_{std::move(type)}
+#if defined(threadpool11_ENQUEUE_TIME)
+      , enqueue_time_{0}
+#endif
+#if defined(threadpool11_TRACE)
+      , label_{nullptr}
+#endif
+  {
+    ops_for<typename std::decay<F>::type>::construct(&storage_, std::forward<F>(callable));
   }
 
-  work(const work&) = delete;
-  work(work&&) = default;
+  work(work&& other)
+      : ops_{other.ops_}
+      , type_{other.type_}
+#if defined(threadpool11_ENQUEUE_TIME)
+      , enqueue_time_{other.enqueue_time_}
+#endif
+#if defined(threadpool11_TRACE)
+      , label_{other.label_}
+#endif
+  {
+    ops_->move(&other.storage_, &storage_);
+  }
+
+  ~work() { ops_->destroy(&storage_); }
 
+  work(const work&) = delete;
   work& operator=(const work&) = delete;
-  work& operator=(work&&) = default;
+  work& operator=(work&&) = delete;
 
   type_t type() const { return type_; }
 
-  void operator()() const { callable_(); }
+#if defined(threadpool11_ENQUEUE_TIME)
+  /**
+   * Steady clock nanoseconds of when the work was posted, for pool::snapshot and pool::trace.
+   */
+  std::uint64_t enqueue_time() const { return enqueue_time_; }
+  void set_enqueue_time(std::uint64_t time) { enqueue_time_ = time; }
+#endif
+
+  /**
+   * The name the work has in pool::trace, nullptr if it has none. The string is not copied.
+   * Only kept if built with threadpool11_TRACE defined.
+   */
+#if defined(threadpool11_TRACE)
+  const char* label() const { return label_; }
+  void set_label(const char* label) { label_ = label; }
+#else
+  const char* label() const { return nullptr; }
+  void set_label(const char*) {}
+#endif
+
+  void operator()() { ops_->invoke(&storage_); }
+
+  static void* operator new(std::size_t size) { return small_object_allocator::allocate(size); }
+  static void operator delete(void* ptr, std::size_t size) { small_object_allocator::deallocate(ptr, size); }
 
 private:
+  using storage_t = std::aligned_storage<storage_size, alignof(std::max_align_t)>::type;
+
+  struct ops_t {
+    void (*invoke)(void*);
+    void (*move)(void*, void*);
+    void (*destroy)(void*);
+  };
+
+  template <class F>
+  struct is_inline
+      : std::integral_constant<bool, sizeof(F) <= sizeof(storage_t) && alignof(F) <= alignof(storage_t) &&
+                                         std::is_nothrow_move_constructible<F>::value> {};
+
+  template <class F, bool = is_inline<F>::value>
+  struct ops_for {
+    template <class G>
+    static void construct(void* storage, G&& callable) {
+      ::new (storage) F(std::forward<G>(callable));
+    }
+
+    static void invoke(void* storage) { (*static_cast<F*>(storage))(); }
+    static void move(void* from, void* to) {
+      ::new (to) F(std::move(*static_cast<F*>(from)));
+    }
+    static void destroy(void* storage) { static_cast<F*>(storage)->~F(); }
+
+    static const ops_t ops;
+  };
+
+  template <class F>
+  struct ops_for<F, false> {
+    template <class G>
+    static void construct(void* storage, G&& callable) {
+      ::new (storage) F*(new F(std::forward<G>(callable)));
+    }
+
+    static void invoke(void* storage) { (**static_cast<F**>(storage))(); }
+    static void move(void* from, void* to) {
+      ::new (to) F*(*static_cast<F**>(from));
+      *static_cast<F**>(from) = nullptr;
+    }
+    static void destroy(void* storage) { delete *static_cast<F**>(storage); }
+
+    static const ops_t ops;
+  };
+
+private:
+  const ops_t* ops_;
   type_t type_;
-  callable_t callable_;
+#if defined(threadpool11_ENQUEUE_TIME)
+  std::uint64_t enqueue_time_;
+#endif
+#if defined(threadpool11_TRACE)
+  const char* label_;
+#endif
+  storage_t storage_;
 };
 
-}
+template <class F, bool Inline>
+const work::ops_t work::ops_for<F, Inline>::ops = {&invoke, &move, &destroy};
+
+template <class F>
+const work::ops_t work::ops_for<F, false>::ops = {&invoke, &move, &destroy};
 
+}
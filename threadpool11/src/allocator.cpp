@@ -0,0 +1,161 @@
+#include "threadpool11/allocator.hpp"
+
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace threadpool11 {
+
+namespace {
+
+struct free_node {
+  free_node* next;
+};
+
+/**
+ * Size classes are 32, 64, 128 and 256 bytes.
+ */
+constexpr std::size_t min_class_size = 32;
+constexpr std::size_t class_count = 4;
+
+/**
+ * Nodes move between threads in batches so that the usual producer/worker
+ * pattern (one thread allocates, another one frees) only takes the depot lock
+ * once per batch_size blocks.
+ */
+constexpr std::size_t batch_size = 64;
+constexpr std::size_t max_depot_batches = 1024;
+
+std::size_t size_class(std::size_t size) {
+  std::size_t index = 0;
+  while ((min_class_size << index) < size) {
+    ++index;
+  }
+  return index;
+}
+
+class depot {
+public:
+  using batch_t = std::pair<free_node*, std::size_t>;
+
+  batch_t take() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (batches_.empty()) {
+      return batch_t{nullptr, 0};
+    }
+    const batch_t batch = batches_.back();
+    batches_.pop_back();
+    return batch;
+  }
+
+  void give(batch_t batch) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (batches_.size() < max_depot_batches) {
+        batches_.push_back(batch);
+        return;
+      }
+    }
+
+    while (batch.first != nullptr) {
+      free_node* const next = batch.first->next;
+      ::operator delete(batch.first);
+      batch.first = next;
+    }
+  }
+
+private:
+  std::mutex mutex_;
+  std::vector<batch_t> batches_;
+};
+
+depot& get_depot(std::size_t index) {
+  // intentionally leaked, detached workers may still free blocks during static destruction
+  static depot* const instances = new depot[class_count];
+  return instances[index];
+}
+
+class cache {
+public:
+  explicit cache(std::size_t index)
+      : index_{index} {
+  }
+
+  ~cache() {
+    if (head_ != nullptr) {
+      get_depot(index_).give(depot::batch_t{head_, count_});
+    }
+  }
+
+  void* allocate() {
+    if (head_ == nullptr) {
+      const depot::batch_t batch = get_depot(index_).take();
+      if (batch.first == nullptr) {
+        return ::operator new(min_class_size << index_);
+      }
+      head_ = batch.first;
+      count_ = batch.second;
+    }
+
+    free_node* const node = head_;
+    head_ = node->next;
+    --count_;
+    return node;
+  }
+
+  void deallocate(void* ptr) {
+    free_node* const node = static_cast<free_node*>(ptr);
+    node->next = head_;
+    head_ = node;
+
+    if (++count_ >= 2 * batch_size) {
+      free_node* last = head_;
+      for (std::size_t i = 1; i < batch_size; ++i) {
+        last = last->next;
+      }
+      const depot::batch_t batch{head_, batch_size};
+      head_ = last->next;
+      last->next = nullptr;
+      count_ -= batch_size;
+      get_depot(index_).give(batch);
+    }
+  }
+
+private:
+  const std::size_t index_;
+  free_node* head_ = nullptr;
+  std::size_t count_ = 0;
+};
+
+static_assert(class_count == 4, "caches has to be updated with the size classes");
+
+struct caches {
+  cache items[class_count] = {cache{0}, cache{1}, cache{2}, cache{3}};
+};
+
+thread_local caches local_caches;
+
+}
+
+constexpr std::size_t small_object_allocator::max_size;
+
+void* small_object_allocator::allocate(std::size_t size) {
+  if (size > max_size) {
+    return ::operator new(size);
+  }
+  return local_caches.items[size_class(size)].allocate();
+}
+
+void small_object_allocator::deallocate(void* ptr, std::size_t size) {
+  if (ptr == nullptr) {
+    return;
+  }
+  if (size > max_size) {
+    ::operator delete(ptr);
+    return;
+  }
+  local_caches.items[size_class(size)].deallocate(ptr);
+}
+
+}
@@ -0,0 +1,94 @@
+#include "threadpool11/futex.hpp"
+
+#include <limits>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#endif
+
+namespace threadpool11 {
+
+#if defined(__linux__)
+
+namespace {
+
+long futex(std::atomic<std::uint32_t>& word, int op, std::uint32_t value, const timespec* timeout) {
+  return syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), op | FUTEX_PRIVATE_FLAG, value, timeout,
+                 nullptr, 0);
+}
+
+}
+
+void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t expected) {
+  futex(word, FUTEX_WAIT, expected, nullptr);
+}
+
+void futex_wait_for(std::atomic<std::uint32_t>& word, std::uint32_t expected, std::chrono::nanoseconds timeout) {
+  if (timeout.count() <= 0) {
+    return;
+  }
+
+  const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+  timespec ts;
+  ts.tv_sec = static_cast<time_t>(seconds.count());
+  ts.tv_nsec = static_cast<long>((timeout - seconds).count());
+  futex(word, FUTEX_WAIT, expected, &ts);
+}
+
+void futex_wake(std::atomic<std::uint32_t>& word, std::uint32_t count) {
+  const std::uint32_t max = std::numeric_limits<int>::max();
+  futex(word, FUTEX_WAKE, count < max ? count : max, nullptr);
+}
+
+#else
+
+namespace {
+
+struct bucket {
+  std::mutex mutex;
+  std::condition_variable cv;
+};
+
+constexpr std::size_t bucket_count = 64;
+
+bucket& get_bucket(const void* address) {
+  // intentionally leaked, detached workers may still wait during static destruction
+  static bucket* const buckets = new bucket[bucket_count];
+  return buckets[std::hash<const void*>()(address) % bucket_count];
+}
+
+}
+
+void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t expected) {
+  bucket& b = get_bucket(&word);
+  std::unique_lock<std::mutex> lock(b.mutex);
+  if (word.load(std::memory_order_acquire) == expected) {
+    b.cv.wait(lock);
+  }
+}
+
+void futex_wait_for(std::atomic<std::uint32_t>& word, std::uint32_t expected, std::chrono::nanoseconds timeout) {
+  bucket& b = get_bucket(&word);
+  std::unique_lock<std::mutex> lock(b.mutex);
+  if (word.load(std::memory_order_acquire) == expected) {
+    b.cv.wait_for(lock, timeout);
+  }
+}
+
+void futex_wake(std::atomic<std::uint32_t>& word, std::uint32_t) {
+  // buckets are shared between addresses, so everyone has to be woken up
+  bucket& b = get_bucket(&word);
+  { std::lock_guard<std::mutex> lock(b.mutex); }
+  b.cv.notify_all();
+}
+
+#endif
+
+}
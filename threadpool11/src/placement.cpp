@@ -0,0 +1,223 @@
+#include "threadpool11/placement.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <sched.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#endif
+
+namespace threadpool11 {
+
+namespace {
+
+#if defined(__linux__)
+
+/**
+ * Parses the kernel's CPU list format, e.g. "0-3,8,10-11".
+ */
+std::vector<unsigned> parse_cpu_list(const std::string& list) {
+  std::vector<unsigned> cpus;
+
+  const char* p = list.c_str();
+  while (*p != '\0') {
+    char* end;
+    const unsigned long first = std::strtoul(p, &end, 10);
+    if (end == p) {
+      break;
+    }
+    unsigned long last = first;
+    p = end;
+    if (*p == '-') {
+      last = std::strtoul(p + 1, &end, 10);
+      p = end;
+    }
+    for (unsigned long cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(static_cast<unsigned>(cpu));
+    }
+    while (*p == ',' || *p == '\n') {
+      ++p;
+    }
+  }
+
+  return cpus;
+}
+
+std::vector<unsigned> allowed_cpus() {
+  std::vector<unsigned> cpus;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+
+  return cpus;
+}
+
+std::vector<std::vector<unsigned>> discover_nodes() {
+  const std::vector<unsigned> allowed = allowed_cpus();
+
+  std::vector<std::pair<unsigned long, std::vector<unsigned>>> nodes;
+  if (DIR* const dir = opendir("/sys/devices/system/node")) {
+    while (const dirent* const entry = readdir(dir)) {
+      char* end;
+      if (std::strncmp(entry->d_name, "node", 4) != 0) {
+        continue;
+      }
+      const unsigned long id = std::strtoul(entry->d_name + 4, &end, 10);
+      if (end == entry->d_name + 4 || *end != '\0') {
+        continue;
+      }
+
+      std::ifstream file(std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist");
+      std::string list;
+      std::getline(file, list);
+
+      std::vector<unsigned> cpus;
+      for (const unsigned cpu : parse_cpu_list(list)) {
+        if (allowed.empty() || std::binary_search(allowed.begin(), allowed.end(), cpu)) {
+          cpus.push_back(cpu);
+        }
+      }
+      if (!cpus.empty()) {
+        nodes.emplace_back(id, std::move(cpus));
+      }
+    }
+    closedir(dir);
+  }
+
+  std::vector<std::vector<unsigned>> result;
+  if (nodes.empty()) {
+    if (!allowed.empty()) {
+      result.push_back(allowed);
+    }
+  } else {
+    std::sort(nodes.begin(), nodes.end());
+    for (auto& node : nodes) {
+      result.push_back(std::move(node.second));
+    }
+  }
+
+  return result;
+}
+
+#else
+
+std::vector<std::vector<unsigned>> discover_nodes() { return {}; }
+
+#endif
+
+}
+
+topology::topology(std::vector<std::vector<unsigned>> nodes)
+    : nodes_(std::move(nodes)) {
+  if (nodes_.empty()) {
+    nodes_.emplace_back();
+    for (unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu) {
+      nodes_.back().push_back(cpu);
+    }
+  }
+
+  for (size_type node = 0; node < nodes_.size(); ++node) {
+    for (const unsigned cpu : nodes_[node]) {
+      if (cpu >= cpu_nodes_.size()) {
+        cpu_nodes_.resize(cpu + 1, 0);
+      }
+      cpu_nodes_[cpu] = node;
+    }
+  }
+}
+
+const topology& topology::get() {
+  static const topology instance{discover_nodes()};
+  return instance;
+}
+
+topology::size_type topology::node_of(unsigned cpu) const { return cpu < cpu_nodes_.size() ? cpu_nodes_[cpu] : 0; }
+
+topology::size_type topology::current_node() const {
+#if defined(__linux__)
+  if (nodes_.size() > 1) {
+    const int cpu = sched_getcpu();
+    if (cpu >= 0) {
+      return node_of(static_cast<unsigned>(cpu));
+    }
+  }
+#endif
+  return 0;
+}
+
+bool set_thread_affinity(const std::vector<unsigned>& cpus) {
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (const unsigned cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  return CPU_COUNT(&set) > 0 && sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
+
+placement::assignment placement::assign(size_type worker, const topology& topology) const {
+  const size_type node_count = topology.node_count();
+
+  switch (policy_) {
+  case policy_t::COMPACT: {
+    size_type cpu_count = 0;
+    for (size_type node = 0; node < node_count; ++node) {
+      cpu_count += topology.node_cpus(node).size();
+    }
+
+    size_type i = worker % std::max<size_type>(1, cpu_count);
+    for (size_type node = 0; node < node_count; ++node) {
+      const auto& cpus = topology.node_cpus(node);
+      if (i < cpus.size()) {
+        return assignment{{cpus[i]}, node};
+      }
+      i -= cpus.size();
+    }
+    break;
+  }
+
+  case policy_t::SCATTER: {
+    const size_type node = worker % node_count;
+    const auto& cpus = topology.node_cpus(node);
+    if (!cpus.empty()) {
+      return assignment{{cpus[(worker / node_count) % cpus.size()]}, node};
+    }
+    break;
+  }
+
+  case policy_t::NUMA_NODE: {
+    const size_type node = worker % node_count;
+    return assignment{topology.node_cpus(node), node};
+  }
+
+  case policy_t::CPU_LIST: {
+    const unsigned cpu = cpus_[worker % cpus_.size()];
+    return assignment{{cpu}, topology.node_of(cpu)};
+  }
+
+  case policy_t::NONE:
+    break;
+  }
+
+  return assignment{{}, 0};
+}
+
+}
@@ -1,64 +1,1592 @@
-﻿#include "threadpool11/pool.hpp"
-
-#include <algorithm>
-#include <future>
-#include <vector>
-
-namespace threadpool11 {
-
-const pool::no_future_t pool::no_future_tag;
-
-pool::pool(size_type worker_count)
-    : worker_count_{0}
-    , work_queue_{0}
-    , work_queue_size_{0} {
-  increase_worker_count(worker_count);
-}
-
-pool::~pool() { join_all(); }
-
-void pool::join_all() { decrease_worker_count(std::numeric_limits<size_type>::max(), method_t::SYNC); }
-
-void pool::set_worker_count(size_type n, method_t method) {
-  if (get_worker_count() < n) {
-    increase_worker_count(n - get_worker_count());
-  } else {
-    decrease_worker_count(get_worker_count() - n, method);
-  }
-}
-
-void pool::increase_worker_count(size_type n) {
-  worker_count_ += n;
-
-  while (n-- > 0) {
-    std::thread thread{std::bind(&pool::worker_main, this)};
-    thread.detach();
-  }
-}
-
-void pool::decrease_worker_count(size_type n, method_t method) {
-  std::vector<std::future<void>> futures;
-  n = std::min(n, get_worker_count());
-
-  worker_count_ -= n;
-
-  if (method == method_t::SYNC) {
-    futures.reserve(n);
-  }
-
-  while (n > 0) {
-    --n;
-
-    if (method == method_t::SYNC) {
-      futures.emplace_back(post_work<void>(work_t::type_t::TERMINAL, []() {}));
-    } else {
-      post_work<void>(work_t::type_t::TERMINAL, []() {}, no_future_tag);
-    }
-  }
-
-  for (auto& future : futures) {
-    future.get();
-  }
-}
-
-}
+﻿#include "threadpool11/pool.hpp"
+#include "threadpool11/deque.hpp"
+#include "threadpool11/strand.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// trace builds stamp works with the TSC, statistics need nanoseconds right away
+#if defined(threadpool11_TRACE) && !defined(threadpool11_STATS)
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <x86intrin.h>
+#define threadpool11_TSC
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define threadpool11_TSC
+#endif
+#endif
+
+namespace threadpool11 {
+
+const pool::no_future_t pool::no_future_tag;
+
+constexpr pool::size_type pool::priority_count;
+constexpr pool::size_type pool::keyed_strand_count;
+constexpr pool::size_type pool::no_worker;
+constexpr pool::size_type pool::trace_capacity;
+constexpr std::size_t adaptive_partitioner::splits_per_worker;
+constexpr pool::size_type pool::strand::batch_size;
+
+namespace {
+
+/**
+ * Every starvation_period'th work a worker takes is looked up from the lowest priority level up.
+ */
+constexpr std::size_t starvation_period = 32;
+
+constexpr std::size_t normal_level = static_cast<std::size_t>(pool::priority_t::NORMAL);
+
+#if defined(threadpool11_ENQUEUE_TIME)
+
+std::uint64_t now_ns() {
+  return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                        std::chrono::steady_clock::now().time_since_epoch())
+                                        .count());
+}
+
+/**
+ * The clock works are stamped with, see to_ns.
+ */
+#if defined(threadpool11_TSC)
+std::uint64_t now_ticks() { return __rdtsc(); }
+#else
+std::uint64_t now_ticks() { return now_ns(); }
+#endif
+
+#endif
+
+#if defined(threadpool11_TSC)
+
+struct tsc_scale {
+  std::uint64_t ticks;
+  std::uint64_t ns;
+  double ns_per_tick;
+};
+
+/**
+ * Measured against the steady clock over 10ms on the first call. The TSC runs at a constant rate
+ * on CPUs that have one that is fit for timing.
+ */
+const tsc_scale& get_tsc_scale() {
+  static const tsc_scale scale = []() {
+    const std::uint64_t ticks = now_ticks();
+    const std::uint64_t ns = now_ns();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    const std::uint64_t ticks_end = now_ticks();
+    const std::uint64_t ns_end = now_ns();
+    return tsc_scale{ticks_end, ns_end,
+                     static_cast<double>(ns_end - ns) / static_cast<double>(ticks_end - ticks)};
+  }();
+  return scale;
+}
+
+/**
+ * Converts a now_ticks() time to steady clock nanoseconds.
+ */
+std::uint64_t to_ns(std::uint64_t ticks) {
+  const tsc_scale& scale = get_tsc_scale();
+  const auto elapsed = static_cast<std::int64_t>(ticks - scale.ticks);
+  const double offset = static_cast<double>(elapsed) * scale.ns_per_tick;
+  return scale.ns + static_cast<std::uint64_t>(static_cast<std::int64_t>(offset));
+}
+
+#elif defined(threadpool11_TRACE)
+
+std::uint64_t to_ns(std::uint64_t ticks) { return ticks; }
+
+#endif
+
+#if defined(threadpool11_STATS)
+
+/**
+ * Single writer counter, readers only see it from snapshot().
+ */
+void add(std::atomic<std::uint64_t>& counter, std::uint64_t value) {
+  counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+/**
+ * Counters of a worker slot, written by the thread running it only. Padded to keep
+ * them off the cache lines thieves touch.
+ */
+struct worker_counters {
+  worker_counters()
+      : depth{0}
+      , idle_since{0}
+      , parked_while_idle{0} {
+    for (auto* counter : {&tasks_executed, &steals, &parks, &busy_time, &idle_time, &parked_time}) {
+      counter->store(0, std::memory_order_relaxed);
+    }
+    for (std::size_t i = 0; i < latency_histogram::bucket_count; ++i) {
+      queue_latency[i].store(0, std::memory_order_relaxed);
+      run_time[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  void on_idle() {
+    if (idle_since == 0) {
+      idle_since = now_ns();
+      parked_while_idle = 0;
+    }
+  }
+
+  void on_park(std::uint64_t begin, std::uint64_t end) {
+    add(parks, 1);
+    add(parked_time, end - begin);
+    parked_while_idle += end - begin;
+  }
+
+  void on_start(std::uint64_t start, std::uint64_t enqueue_time) {
+    if (idle_since != 0) {
+      add(idle_time, start - idle_since - std::min(start - idle_since, parked_while_idle));
+      idle_since = 0;
+    }
+    add(queue_latency[latency_histogram::bucket_of(start > enqueue_time ? start - enqueue_time : 0)], 1);
+    ++depth;
+  }
+
+  void on_finish(std::uint64_t start, std::uint64_t finish) {
+    --depth;
+    add(tasks_executed, 1);
+    add(run_time[latency_histogram::bucket_of(finish - start)], 1);
+    if (depth == 0) {
+      add(busy_time, finish - start);
+    }
+  }
+
+  char front_padding[64];
+
+  std::atomic<std::uint64_t> tasks_executed;
+  std::atomic<std::uint64_t> steals;
+  std::atomic<std::uint64_t> parks;
+  std::atomic<std::uint64_t> busy_time;
+  std::atomic<std::uint64_t> idle_time;
+  std::atomic<std::uint64_t> parked_time;
+  std::atomic<std::uint64_t> queue_latency[latency_histogram::bucket_count];
+  std::atomic<std::uint64_t> run_time[latency_histogram::bucket_count];
+
+  // works run while waiting for a future nest, only the outermost counts as busy time
+  std::size_t depth;
+  std::uint64_t idle_since;
+  std::uint64_t parked_while_idle;
+
+  char back_padding[64];
+};
+
+#endif
+
+#if defined(threadpool11_TRACE)
+
+/**
+ * The last pool::trace_capacity works a worker slot ran. Written by the thread running the slot
+ * without locks, readers copy the events out and drop the ones that were overwritten meanwhile.
+ */
+class worker_trace {
+public:
+  worker_trace()
+      : stolen{false}
+      , events_{new event[pool::trace_capacity]}
+      , head_{0} {
+  }
+
+  void record(const char* label, std::uint64_t enqueue_time, std::uint64_t start, std::uint64_t end,
+              bool stolen) {
+    const std::uint64_t head = head_.load(std::memory_order_relaxed);
+    event& e = events_[head % pool::trace_capacity];
+
+    // a reader that sees any of these stores sees head_ move past head once it checks again
+    std::atomic_thread_fence(std::memory_order_release);
+    e.label.store(label, std::memory_order_relaxed);
+    e.stolen.store(stolen, std::memory_order_relaxed);
+    e.enqueue_time.store(enqueue_time, std::memory_order_relaxed);
+    e.start_time.store(start, std::memory_order_relaxed);
+    e.end_time.store(end, std::memory_order_relaxed);
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  void copy(std::size_t worker, std::vector<trace_event>& events) const {
+    const std::uint64_t end = head_.load(std::memory_order_acquire);
+    const std::uint64_t begin = end > pool::trace_capacity ? end - pool::trace_capacity : 0;
+
+    const std::size_t first = events.size();
+    for (std::uint64_t i = begin; i < end; ++i) {
+      const event& e = events_[i % pool::trace_capacity];
+      events.push_back(trace_event{e.label.load(std::memory_order_relaxed), worker,
+                                   e.stolen.load(std::memory_order_relaxed),
+                                   e.enqueue_time.load(std::memory_order_relaxed),
+                                   e.start_time.load(std::memory_order_relaxed),
+                                   e.end_time.load(std::memory_order_relaxed)});
+    }
+
+    // the slots of the events recorded meanwhile, and of the one being recorded, may be torn
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const std::uint64_t head = head_.load(std::memory_order_relaxed);
+    const std::uint64_t valid = head + 1 > pool::trace_capacity ? head + 1 - pool::trace_capacity : 0;
+    if (valid > begin) {
+      const std::size_t torn = static_cast<std::size_t>(std::min(valid, end) - begin);
+      events.erase(events.begin() + first, events.begin() + first + torn);
+    }
+  }
+
+  // whether the work being taken comes from another worker, see pool::steal
+  bool stolen;
+
+private:
+  struct event {
+    std::atomic<const char*> label;
+    std::atomic<bool> stolen;
+    std::atomic<std::uint64_t> enqueue_time;
+    std::atomic<std::uint64_t> start_time;
+    std::atomic<std::uint64_t> end_time;
+  };
+
+  std::unique_ptr<event[]> events_;
+  std::atomic<std::uint64_t> head_;
+};
+
+/**
+ * Writes s as the contents of a JSON string.
+ */
+void write_json(std::ostream& out, const char* s) {
+  for (; *s != '\0'; ++s) {
+    const unsigned char c = static_cast<unsigned char>(*s);
+    if (c == '"' || c == '\\') {
+      out << '\\' << *s;
+    } else if (c < 0x20) {
+      out << "\\u00" << "0123456789abcdef"[c >> 4] << "0123456789abcdef"[c & 0xf];
+    } else {
+      out << *s;
+    }
+  }
+}
+
+/**
+ * Writes nanoseconds as the microseconds trace event JSON uses. Kept signed so that stamps out of order
+ * show up as negative times instead of being hidden.
+ */
+void write_us(std::ostream& out, std::int64_t nanoseconds) {
+  if (nanoseconds < 0) {
+    out << '-';
+    nanoseconds = -nanoseconds;
+  }
+  out << nanoseconds / 1000 << '.' << std::setw(3) << std::setfill('0') << nanoseconds % 1000 << std::setfill(' ');
+}
+
+#endif
+
+/**
+ * Producer shards per node, a power of two around the number of CPUs of a node.
+ */
+std::size_t shards_per_node(std::size_t node_count) {
+  const std::size_t cpus = std::max<std::size_t>(1, std::thread::hardware_concurrency() / node_count);
+  std::size_t n = 1;
+  while (n < cpus && n < 16) {
+    n *= 2;
+  }
+  return n;
+}
+
+/**
+ * Numbers the threads that post to pools in the order they first do, picks their shard.
+ */
+std::size_t producer_index() {
+  static std::atomic<std::size_t> next{0};
+  static thread_local const std::size_t index = next.fetch_add(1, std::memory_order_relaxed);
+  return index;
+}
+
+/**
+ * All CPUs the process may run on, threads go back to the cache unpinned.
+ */
+const std::vector<unsigned>& process_cpus() {
+  static const std::vector<unsigned> cpus = []() {
+    const topology& t = topology::get();
+    std::vector<unsigned> result;
+    for (std::size_t node = 0; node < t.node_count(); ++node) {
+      result.insert(result.end(), t.node_cpus(node).begin(), t.node_cpus(node).end());
+    }
+    return result;
+  }();
+  return cpus;
+}
+
+}
+
+thread_local pool::worker* pool::current_worker_ = nullptr;
+
+/**
+ * Worker threads are detached, they count themselves out here once they are done
+ * with the pool. Shared with the threads so that it outlives the pool.
+ */
+struct pool::exit_state {
+  exit_state()
+      : running{0} {
+  }
+
+  std::atomic<size_type> running;
+  event_count event;
+};
+
+/**
+ * A worker slot. Slots outlive the threads running them and get reused by
+ * newly spawned threads so that thieves never look at freed memory.
+ */
+class pool::worker : public wait_helper {
+public:
+  worker(pool& owner, size_type index, placement::assignment assignment)
+      : owner{owner}
+      , index{index}
+      , node{assignment.node}
+      , cpus(std::move(assignment.cpus))
+      , active{false}
+      , rng{static_cast<std::uint32_t>(index * 2654435761u + 1)}
+      , taken{0}
+      , blocking_depth{0}
+      , inbox{0}
+      , inbox_size{0}
+      , inbox_since{0}
+      , parked{false} {
+  }
+
+  bool help() override { return owner.help(*this); }
+
+  std::uint32_t next_random() {
+    // xorshift32
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+  }
+
+  pool& owner;
+  const size_type index;
+  const size_type node;
+  const std::vector<unsigned> cpus;
+  std::atomic<bool> active;
+  std::uint32_t rng;
+  size_type taken;
+  size_type blocking_depth;
+  work_stealing_deque<work_t*> deque;
+
+  // works posted to this slot with post_to, inbox_since is when its worker last took one or it got one while empty
+  queue_t inbox;
+  std::atomic<size_type> inbox_size;
+  std::atomic<timer_clock::rep> inbox_since;
+  std::atomic<bool> parked;
+#if defined(threadpool11_STATS)
+  worker_counters stats;
+#endif
+#if defined(threadpool11_TRACE)
+  worker_trace trace;
+#endif
+};
+
+/**
+ * Append-only table of worker slots. Readers (thieves) are lock-free, the
+ * slot array is grown by copying and the old arrays are kept until the table
+ * is destroyed.
+ */
+class pool::worker_table {
+public:
+  worker_table()
+      : slots_{nullptr}
+      , size_{0} {
+  }
+
+  /**
+   * Activates an inactive slot, creating a new one if there is none.
+   */
+  worker& acquire(pool& owner) {
+    std::lock_guard<mutex_t> lock(mutex_);
+
+    for (auto& w : workers_) {
+      if (!w->active.load(std::memory_order_acquire)) {
+        w->active.store(true, std::memory_order_relaxed);
+        return *w;
+      }
+    }
+
+    const size_type n = workers_.size();
+    workers_.emplace_back(new worker(owner, n,
+                                     owner.placement_.policy() == placement::policy_t::NONE
+                                         ? placement::assignment{{}, 0}
+                                         : owner.placement_.assign(n, topology::get())));
+    worker* const w = workers_.back().get();
+    w->active.store(true, std::memory_order_relaxed);
+
+    if (arrays_.empty() || capacity_ == n) {
+      capacity_ = std::max<size_type>(8, capacity_ * 2);
+      std::unique_ptr<worker*[]> slots{new worker*[capacity_]};
+      for (size_type i = 0; i < n; ++i) {
+        slots[i] = workers_[i].get();
+      }
+      slots_.store(slots.get(), std::memory_order_release);
+      arrays_.emplace_back(std::move(slots));
+    }
+    slots_.load(std::memory_order_relaxed)[n] = w;
+    size_.store(n + 1, std::memory_order_release);
+
+    return *w;
+  }
+
+  size_type size() const { return size_.load(std::memory_order_acquire); }
+
+  worker& operator[](size_type i) const { return *slots_.load(std::memory_order_acquire)[i]; }
+
+private:
+  mutex_t mutex_;
+  std::vector<std::unique_ptr<worker>> workers_;
+  std::vector<std::unique_ptr<worker*[]>> arrays_;
+  size_type capacity_ = 0;
+
+  std::atomic<worker**> slots_;
+  std::atomic<size_type> size_;
+};
+
+pool::pool(size_type worker_count, const threadpool11::placement& placement)
+    : worker_count_{0}
+    , live_worker_count_{0}
+    , blocking_count_{0}
+    , exits_{std::make_shared<exit_state>()}
+    , pending_workers_{0}
+    , started_{false}
+    , autoscale_{false}
+    , autoscale_min_{0}
+    , autoscale_max_{0}
+    , autoscale_queue_depth_{0}
+    , autoscale_keep_alive_{0}
+    , autoscale_delay_{0}
+    , pressure_since_{0}
+    , idle_spin_count_{idle_policy().spin_count}
+    , idle_yield_count_{idle_policy().yield_count}
+    , inbox_steal_delay_{std::chrono::duration_cast<timer_clock::duration>(idle_policy().inbox_steal_delay).count()}
+    , placement_{placement}
+    , node_count_{placement.policy() == threadpool11::placement::policy_t::NONE ? 1 : topology::get().node_count()}
+    , shards_per_node_{shards_per_node(node_count_)}
+    , work_queue_size_{0}
+    , inbox_work_count_{0}
+    , capacity_{0}
+    , workers_{new worker_table}
+    , timer_count_{0}
+    , next_timer_{timer_clock::time_point::max().time_since_epoch().count()} {
+  for (auto& level : levels_) {
+    for (size_type node = 0; node < node_count_; ++node) {
+      level.queues.emplace_back(new queue_t{0});
+    }
+  }
+  for (size_type i = 0; i < node_count_ * shards_per_node_; ++i) {
+    shards_.emplace_back(new shard_t);
+  }
+
+  increase_worker_count(worker_count);
+}
+
+pool::~pool() { join_all(); }
+
+void pool::join_all() {
+  disable_autoscale();
+
+  // a worker may still have been growing the pool while autoscaling was turned off
+  do {
+    decrease_worker_count(std::numeric_limits<size_type>::max(), method_t::SYNC);
+  } while (exits_->running.load(std::memory_order_seq_cst) != 0);
+}
+
+void pool::set_worker_count(size_type n, method_t method) {
+  const size_type count = worker_count_.exchange(n, std::memory_order_seq_cst);
+  if (count < n) {
+    add_pending(n - count);
+  } else if (count > n) {
+    release_workers(method);
+  }
+}
+
+pool::idle_policy pool::get_idle_policy() const {
+  return idle_policy{idle_spin_count_.load(std::memory_order_relaxed), idle_yield_count_.load(std::memory_order_relaxed),
+                     std::chrono::duration_cast<std::chrono::microseconds>(
+                         timer_clock::duration{inbox_steal_delay_.load(std::memory_order_relaxed)})};
+}
+
+void pool::set_idle_policy(const idle_policy& policy) {
+  idle_spin_count_.store(policy.spin_count, std::memory_order_relaxed);
+  idle_yield_count_.store(policy.yield_count, std::memory_order_relaxed);
+  inbox_steal_delay_.store(std::chrono::duration_cast<timer_clock::duration>(policy.inbox_steal_delay).count(),
+                           std::memory_order_relaxed);
+}
+
+void pool::set_autoscale_policy(const autoscale_policy& policy) {
+  autoscale_min_.store(policy.min_workers, std::memory_order_relaxed);
+  autoscale_max_.store(std::max(policy.min_workers, policy.max_workers), std::memory_order_relaxed);
+  autoscale_queue_depth_.store(policy.queue_depth, std::memory_order_relaxed);
+  autoscale_keep_alive_.store(std::chrono::duration_cast<timer_clock::duration>(policy.keep_alive).count(),
+                              std::memory_order_relaxed);
+  autoscale_delay_.store(std::chrono::duration_cast<timer_clock::duration>(policy.scale_up_delay).count(),
+                         std::memory_order_relaxed);
+  pressure_since_.store(0, std::memory_order_relaxed);
+  autoscale_.store(true, std::memory_order_seq_cst);
+
+  const size_type count = get_worker_count();
+  if (count < policy.min_workers) {
+    increase_worker_count(policy.min_workers - count);
+  } else if (count > policy.max_workers) {
+    decrease_worker_count(count - policy.max_workers);
+  }
+
+  // parked workers have to start counting their keep alive time
+  work_signal_.notify_all();
+}
+
+void pool::disable_autoscale() { autoscale_.store(false, std::memory_order_seq_cst); }
+
+pool::autoscale_policy pool::get_autoscale_policy() const {
+  return autoscale_policy{
+      autoscale_min_.load(std::memory_order_relaxed), autoscale_max_.load(std::memory_order_relaxed),
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          timer_clock::duration{autoscale_keep_alive_.load(std::memory_order_relaxed)}),
+      autoscale_queue_depth_.load(std::memory_order_relaxed),
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          timer_clock::duration{autoscale_delay_.load(std::memory_order_relaxed)})};
+}
+
+void pool::increase_worker_count(size_type n) {
+  // the target goes up first so that no worker sees itself as one too many meanwhile
+  worker_count_.fetch_add(n, std::memory_order_seq_cst);
+  add_pending(n);
+}
+
+void pool::add_pending(size_type n) {
+  pending_workers_.fetch_add(n, std::memory_order_seq_cst);
+
+  if (started_.load(std::memory_order_relaxed) || queued_work_count(std::memory_order_seq_cst) > 0 ||
+      timer_count_.load(std::memory_order_seq_cst) > 0) {
+    start_pending();
+  }
+}
+
+void pool::decrease_worker_count(size_type n, method_t method) {
+  size_type count = worker_count_.load(std::memory_order_relaxed);
+  while (!worker_count_.compare_exchange_weak(count, count - std::min(n, count), std::memory_order_seq_cst)) {
+  }
+  release_workers(method);
+}
+
+void pool::release_workers(method_t method) {
+  work_signal_.notify_all();
+
+  if (method == method_t::SYNC) {
+    wait_for_exits();
+  }
+}
+
+void pool::spawn(size_type n) {
+  const std::shared_ptr<exit_state> exits = exits_;
+  exits->running.fetch_add(n, std::memory_order_seq_cst);
+
+  while (n-- > 0) {
+    worker& w = workers_->acquire(*this);
+    thread_cache::get().run([this, &w, exits]() {
+      worker_main(w);
+      exits->running.fetch_sub(1, std::memory_order_seq_cst);
+      exits->event.notify_all();
+    });
+  }
+}
+
+void pool::start_pending() {
+  started_.store(true, std::memory_order_relaxed);
+
+  // the worker count may have been lowered since, only start as many as are still wanted
+  size_type n = pending_workers_.exchange(0, std::memory_order_seq_cst);
+  size_type live = live_worker_count_.load(std::memory_order_seq_cst);
+  size_type started = 0;
+  while (n > 0 && live < target_worker_count()) {
+    if (live_worker_count_.compare_exchange_weak(live, live + 1, std::memory_order_seq_cst)) {
+      ++live;
+      ++started;
+      --n;
+    }
+  }
+
+  if (started > 0) {
+    spawn(started);
+  }
+}
+
+void pool::wait_for_exits() {
+  exit_state& exits = *exits_;
+
+  while (true) {
+    const std::uint32_t key = exits.event.prepare_wait();
+    if (exits.running.load(std::memory_order_seq_cst) <= worker_count_.load(std::memory_order_seq_cst)) {
+      exits.event.cancel_wait();
+      return;
+    }
+    exits.event.commit_wait(key);
+  }
+}
+
+bool pool::claim_exit() {
+  size_type live = live_worker_count_.load(std::memory_order_seq_cst);
+  size_type count;
+  // the last workers stay until the posted works are done
+  while (live > (count = target_worker_count()) &&
+         (count > 0 || queued_work_count(std::memory_order_seq_cst) == 0)) {
+    if (live_worker_count_.compare_exchange_weak(live, live - 1, std::memory_order_seq_cst)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool pool::retire_idle() {
+  size_type count = worker_count_.load(std::memory_order_relaxed);
+  while (is_autoscaling() && count > autoscale_min_.load(std::memory_order_relaxed)) {
+    if (worker_count_.compare_exchange_weak(count, count - 1, std::memory_order_seq_cst)) {
+      break;
+    }
+  }
+  return claim_exit();
+}
+
+void pool::maybe_grow() {
+  if (!is_autoscaling()) {
+    return;
+  }
+
+  size_type count = worker_count_.load(std::memory_order_relaxed);
+  const size_type queued = queued_work_count(std::memory_order_relaxed);
+  if (queued == 0 || count >= autoscale_max_.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  // with no workers at all the works would never run, otherwise the pressure has to last a while
+  if (count != 0) {
+    timer_clock::rep since = pressure_since_.load(std::memory_order_relaxed);
+    if (queued <= autoscale_queue_depth_.load(std::memory_order_relaxed) * count) {
+      if (since != 0) {
+        pressure_since_.store(0, std::memory_order_relaxed);
+      }
+      return;
+    }
+
+    const timer_clock::rep now = timer_clock::now().time_since_epoch().count();
+    if (since == 0) {
+      pressure_since_.compare_exchange_strong(since, now, std::memory_order_relaxed);
+      return;
+    }
+    // only the one resetting it grows the pool
+    if (now - since < autoscale_delay_.load(std::memory_order_relaxed) ||
+        !pressure_since_.compare_exchange_strong(since, 0, std::memory_order_relaxed)) {
+      return;
+    }
+  }
+
+  if (worker_count_.compare_exchange_strong(count, count + 1, std::memory_order_seq_cst)) {
+    live_worker_count_.fetch_add(1, std::memory_order_seq_cst);
+    spawn(1);
+  }
+}
+
+void pool::exit_worker(worker& self) {
+  // hand the leftovers to the others, the slot must not be touched once it is released
+  std::uint32_t n = 0;
+  work_t* work;
+  while (self.deque.pop(work)) {
+    levels_[normal_level].queues[self.node]->push(work);
+    ++n;
+  }
+  // still counted on work_queue_size_ once out of the inbox
+  while (self.inbox_size.load(std::memory_order_relaxed) != 0 && self.inbox.pop(work)) {
+    levels_[normal_level].size.fetch_add(1, std::memory_order_relaxed);
+    levels_[normal_level].queues[self.node]->push(work);
+    self.inbox_size.fetch_sub(1, std::memory_order_relaxed);
+    inbox_work_count_.fetch_sub(1, std::memory_order_seq_cst);
+    ++n;
+  }
+  current_worker_ = nullptr;
+  wait_helper::current() = nullptr;
+  if (!self.cpus.empty()) {
+    set_thread_affinity(process_cpus());
+  }
+  self.active.store(false, std::memory_order_release);
+
+  if (n > 0) {
+    work_signal_.notify(n);
+  }
+}
+
+void pool::set_capacity(size_type capacity) {
+  capacity_.store(capacity, std::memory_order_seq_cst);
+  space_signal_.notify_all();
+}
+
+bool pool::admit(size_type n, timer_clock::time_point deadline) {
+  worker* const self = current_worker_;
+  // workers never wait, only they can make space
+  if (capacity_.load(std::memory_order_relaxed) == 0 || (self != nullptr && &self->owner == this)) {
+    work_queue_size_.fetch_add(n, std::memory_order_seq_cst);
+    return true;
+  }
+
+  while (true) {
+    size_type capacity = capacity_.load(std::memory_order_seq_cst);
+    size_type size = work_queue_size_.load(std::memory_order_seq_cst);
+    while (capacity == 0 || size == 0 || size + n <= capacity) {
+      if (work_queue_size_.compare_exchange_weak(size, size + n, std::memory_order_seq_cst)) {
+        return true;
+      }
+      capacity = capacity_.load(std::memory_order_seq_cst);
+    }
+
+    if (deadline == timer_clock::time_point::min()) {
+      return false;
+    }
+
+    const std::uint32_t key = space_signal_.prepare_wait();
+    capacity = capacity_.load(std::memory_order_seq_cst);
+    size = work_queue_size_.load(std::memory_order_seq_cst);
+    if (capacity == 0 || size == 0 || size + n <= capacity) {
+      space_signal_.cancel_wait();
+      continue;
+    }
+
+    if (deadline == timer_clock::time_point::max()) {
+      space_signal_.commit_wait(key);
+    } else {
+      const timer_clock::time_point now = timer_clock::now();
+      if (now >= deadline) {
+        space_signal_.cancel_wait();
+        return false;
+      }
+      space_signal_.commit_wait_for(key, deadline - now);
+    }
+  }
+}
+
+void pool::retract(size_type n) {
+  work_queue_size_.fetch_sub(n, std::memory_order_relaxed);
+  on_dequeue();
+}
+
+void pool::on_dequeue() {
+  if (capacity_.load(std::memory_order_relaxed) != 0) {
+    space_signal_.notify();
+  }
+}
+
+void pool::push(std::unique_ptr<work_t> work, priority_t priority) {
+  if (use_shard(priority)) {
+    push_shard(work.release());
+    return;
+  }
+
+  admit(1, timer_clock::time_point::max());
+  enqueue(work.release(), priority);
+}
+
+void pool::push(work_t* work, priority_t priority) {
+  assert(work->type() == work_t::type_t::EXTERNAL);
+
+  if (use_shard(priority)) {
+    push_shard(work);
+    return;
+  }
+
+  admit(1, timer_clock::time_point::max());
+  enqueue(work, priority);
+}
+
+void pool::push_shared(work_t* work) {
+  assert(work->type() == work_t::type_t::EXTERNAL);
+
+  admit(1, timer_clock::time_point::max());
+  enqueue(work, priority_t::NORMAL, true);
+}
+
+void pool::enqueue(work_t* work, priority_t priority, bool shared) {
+  worker* const self = current_worker_;
+  level_t& level = levels_[static_cast<size_type>(priority)];
+
+  level.size.fetch_add(1, std::memory_order_relaxed);
+
+#if defined(threadpool11_ENQUEUE_TIME)
+  work->set_enqueue_time(now_ticks());
+#endif
+
+  if (!shared && self != nullptr && &self->owner == this && priority == priority_t::NORMAL) {
+    self->deque.push(work);
+  } else {
+    level.queues[current_node()]->push(work);
+  }
+
+  // the queue size is raised by admit, either increase_worker_count sees it or this sees its pending workers
+  if (pending_workers_.load(std::memory_order_seq_cst) != 0) {
+    start_pending();
+  }
+  work_signal_.notify();
+
+  maybe_grow();
+}
+
+void pool::push(std::vector<std::unique_ptr<work_t>> works) {
+  worker* const self = current_worker_;
+  const size_type n = works.size();
+  level_t& level = levels_[normal_level];
+
+  if (use_shard(priority_t::NORMAL)) {
+    push_shard(std::move(works));
+    return;
+  }
+
+  admit(n, timer_clock::time_point::max());
+
+  level.size.fetch_add(n, std::memory_order_relaxed);
+
+#if defined(threadpool11_ENQUEUE_TIME)
+  const std::uint64_t enqueue_time = now_ticks();
+  for (auto& work : works) {
+    work->set_enqueue_time(enqueue_time);
+  }
+#endif
+
+  if (self != nullptr && &self->owner == this) {
+    for (auto& work : works) {
+      self->deque.push(work.release());
+    }
+  } else {
+    queue_t& queue = *level.queues[current_node()];
+    queue.reserve(n);
+    for (auto& work : works) {
+      queue.push(work.release());
+    }
+  }
+
+  if (pending_workers_.load(std::memory_order_seq_cst) != 0) {
+    start_pending();
+  }
+  work_signal_.notify(static_cast<std::uint32_t>(std::min<size_type>(n, std::numeric_limits<std::uint32_t>::max())));
+
+  maybe_grow();
+}
+
+pool::blocking_scope::blocking_scope(pool& owner)
+    : owner_{owner.begin_blocking() ? &owner : nullptr} {
+}
+
+pool::blocking_scope::~blocking_scope() {
+  if (owner_ != nullptr) {
+    owner_->end_blocking();
+  }
+}
+
+bool pool::begin_blocking() {
+  worker* const self = current_worker_;
+  if (self == nullptr || &self->owner != this) {
+    return false;
+  }
+
+  if (self->blocking_depth++ == 0) {
+    // the target goes up first so that the new worker does not see itself as one too many
+    blocking_count_.fetch_add(1, std::memory_order_seq_cst);
+    live_worker_count_.fetch_add(1, std::memory_order_seq_cst);
+    spawn(1);
+  }
+  return true;
+}
+
+void pool::end_blocking() {
+  worker& self = *current_worker_;
+  if (--self.blocking_depth == 0) {
+    blocking_count_.fetch_sub(1, std::memory_order_seq_cst);
+    // a parked worker leaves right away, otherwise the first one to finish its work
+    work_signal_.notify();
+  }
+}
+
+pool::size_type pool::current_worker_index() const {
+  worker* const self = current_worker_;
+  return self != nullptr && &self->owner == this ? self->index : no_worker;
+}
+
+pool::size_type pool::near_worker(std::size_t hash) const {
+  // hashes of pointers and small integers are often the values themselves, mix the bits first
+  const std::uint64_t mixed = static_cast<std::uint64_t>(hash) * 0x9e3779b97f4a7c15u;
+  return static_cast<size_type>((mixed >> 32) % std::max<size_type>(1, get_worker_count()));
+}
+
+void pool::push_to(size_type index, std::unique_ptr<work_t> work) {
+  // the slots are made once the workers start, they have if the pool has started any
+  if (pending_workers_.load(std::memory_order_seq_cst) != 0) {
+    start_pending();
+  }
+
+  const size_type n = workers_->size();
+  worker* const target = n == 0 ? nullptr : &(*workers_)[index % n];
+  if (target == nullptr || !target->active.load(std::memory_order_acquire)) {
+    push(std::move(work), priority_t::NORMAL);
+    return;
+  }
+
+  admit(1, timer_clock::time_point::max());
+  inbox_work_count_.fetch_add(1, std::memory_order_seq_cst);
+
+#if defined(threadpool11_ENQUEUE_TIME)
+  work->set_enqueue_time(now_ticks());
+#endif
+
+  if (target->inbox_size.fetch_add(1, std::memory_order_seq_cst) == 0) {
+    target->inbox_since.store(timer_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+  }
+  target->inbox.push(work.release());
+
+  // either the target sees the work before it parks or this sees it parked, the others are woken
+  // one at a time only to take the work if the target stays busy
+  if (target->parked.load(std::memory_order_seq_cst)) {
+    work_signal_.notify_all();
+  } else {
+    work_signal_.notify();
+  }
+
+  maybe_grow();
+}
+
+bool pool::use_shard(priority_t priority) const {
+  worker* const self = current_worker_;
+  return priority == priority_t::NORMAL && capacity_.load(std::memory_order_relaxed) == 0 &&
+         (self == nullptr || &self->owner != this);
+}
+
+void pool::push_shard(work_t* work) {
+  shard_t& shard = *shards_[current_node() * shards_per_node_ + (producer_index() & (shards_per_node_ - 1))];
+
+#if defined(threadpool11_ENQUEUE_TIME)
+  work->set_enqueue_time(now_ticks());
+#endif
+
+  // counted before it is visible, a worker may see a shard that is not empty yet but never a negative count
+  shard.size.fetch_add(1, std::memory_order_seq_cst);
+  shard.queue.push(work);
+
+  if (pending_workers_.load(std::memory_order_seq_cst) != 0) {
+    start_pending();
+  }
+  work_signal_.notify();
+
+  maybe_grow();
+}
+
+void pool::push_shard(std::vector<std::unique_ptr<work_t>> works) {
+  shard_t& shard = *shards_[current_node() * shards_per_node_ + (producer_index() & (shards_per_node_ - 1))];
+  const size_type n = works.size();
+
+#if defined(threadpool11_ENQUEUE_TIME)
+  const std::uint64_t enqueue_time = now_ticks();
+  for (auto& work : works) {
+    work->set_enqueue_time(enqueue_time);
+  }
+#endif
+
+  shard.size.fetch_add(n, std::memory_order_seq_cst);
+  shard.queue.reserve(n);
+  for (auto& work : works) {
+    shard.queue.push(work.release());
+  }
+
+  if (pending_workers_.load(std::memory_order_seq_cst) != 0) {
+    start_pending();
+  }
+  work_signal_.notify(static_cast<std::uint32_t>(std::min<size_type>(n, std::numeric_limits<std::uint32_t>::max())));
+
+  maybe_grow();
+}
+
+pool::size_type pool::queued_work_count(std::memory_order order) const {
+  return work_queue_size_.load(order) + sharded_work_count(order);
+}
+
+pool::size_type pool::sharded_work_count(std::memory_order order) const {
+  size_type n = 0;
+  for (const auto& shard : shards_) {
+    n += shard->size.load(order);
+  }
+  return n;
+}
+
+future<void> pool::run(task_graph& graph) {
+  if (graph.empty()) {
+    promise<void> promise;
+    promise.set_value();
+    return promise.get_future();
+  }
+
+  for (const auto& node : graph.nodes_) {
+    node->pending.store(node->predecessor_count, std::memory_order_relaxed);
+  }
+
+  std::vector<task_graph::node_data*> roots;
+  for (const auto& node : graph.nodes_) {
+    if (node->predecessor_count == 0) {
+      roots.push_back(node.get());
+    }
+  }
+
+  // Kahn's algorithm, a node is never reached if it is on or after a cycle
+  std::vector<task_graph::node_data*> ready(roots);
+  size_type visited = 0;
+  while (!ready.empty()) {
+    task_graph::node_data* const node = ready.back();
+    ready.pop_back();
+    ++visited;
+    for (task_graph::node_data* const successor : node->successors) {
+      if (successor->pending.fetch_sub(1, std::memory_order_relaxed) == 1) {
+        ready.push_back(successor);
+      }
+    }
+  }
+  if (visited != graph.size()) {
+    throw std::invalid_argument("threadpool11::pool::run: task_graph has a cycle");
+  }
+
+  for (const auto& node : graph.nodes_) {
+    node->pending.store(node->predecessor_count, std::memory_order_relaxed);
+  }
+
+  bulk_state* const state = new bulk_state{graph.size()};
+  auto future = state->get_future();
+
+  std::vector<std::unique_ptr<work_t>> works;
+  works.reserve(roots.size());
+  for (task_graph::node_data* const root : roots) {
+    works.emplace_back(new work_t{work_t::type_t::STANDARD, [this, state, root]() { run_node(state, root); }});
+  }
+  push(std::move(works));
+
+  return future;
+}
+
+void pool::run_node(bulk_state* state, task_graph::node_data* node) {
+  state->run([this, state, node]() {
+    std::exception_ptr exception;
+    if (!state->failed()) {
+      try {
+        node->callable();
+      } catch (...) {
+        exception = std::current_exception();
+      }
+    }
+
+    // posted before this node is counted as done, so the state outlives them
+    for (task_graph::node_data* const successor : node->successors) {
+      if (successor->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        post_work([this, state, successor]() { run_node(state, successor); }, no_future_tag);
+      }
+    }
+
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+  });
+}
+
+void pool::add_timer(timer_clock::time_point deadline, std::unique_ptr<work_t> work) {
+  if (deadline <= timer_clock::now()) {
+    push(std::move(work));
+    return;
+  }
+
+  bool earlier;
+  {
+    std::lock_guard<mutex_t> lock(timer_mutex_);
+    timers_.add(deadline, std::move(work));
+
+    const timer_clock::rep next = timers_.next_expiry().time_since_epoch().count();
+    earlier = next < next_timer_.load(std::memory_order_relaxed);
+    next_timer_.store(next, std::memory_order_seq_cst);
+    timer_count_.store(timers_.size(), std::memory_order_relaxed);
+  }
+
+  if (pending_workers_.load(std::memory_order_relaxed) != 0) {
+    start_pending();
+  }
+
+  // parked workers sleep until the previous earliest timer at most, one of them has to come earlier
+  if (earlier) {
+    work_signal_.notify();
+  }
+}
+
+void pool::poll_timers() {
+  if (timer_count_.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+
+  const timer_clock::time_point now = timer_clock::now();
+  if (now.time_since_epoch().count() < next_timer_.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  std::vector<std::unique_ptr<work_t>> expired;
+  {
+    std::unique_lock<mutex_t> lock(timer_mutex_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      return;
+    }
+
+    timers_.advance(now, expired);
+    next_timer_.store(timers_.next_expiry().time_since_epoch().count(), std::memory_order_seq_cst);
+    timer_count_.store(timers_.size(), std::memory_order_relaxed);
+  }
+
+  if (!expired.empty()) {
+    push(std::move(expired));
+  }
+}
+
+pool_stats pool::snapshot() const {
+  pool_stats stats;
+
+#if defined(threadpool11_STATS)
+  const size_type n = workers_->size();
+  stats.workers.reserve(n);
+  for (size_type i = 0; i < n; ++i) {
+    const worker& w = (*workers_)[i];
+    const worker_counters& c = w.stats;
+
+    worker_stats s;
+    s.index = w.index;
+    s.node = w.node;
+    s.active = w.active.load(std::memory_order_relaxed);
+    s.tasks_executed = c.tasks_executed.load(std::memory_order_relaxed);
+    s.steals = c.steals.load(std::memory_order_relaxed);
+    s.parks = c.parks.load(std::memory_order_relaxed);
+    s.busy_time = std::chrono::nanoseconds(c.busy_time.load(std::memory_order_relaxed));
+    s.idle_time = std::chrono::nanoseconds(c.idle_time.load(std::memory_order_relaxed));
+    s.parked_time = std::chrono::nanoseconds(c.parked_time.load(std::memory_order_relaxed));
+    stats.workers.push_back(s);
+
+    for (size_type b = 0; b < latency_histogram::bucket_count; ++b) {
+      stats.queue_latency.add(b, c.queue_latency[b].load(std::memory_order_relaxed));
+      stats.run_time.add(b, c.run_time[b].load(std::memory_order_relaxed));
+    }
+  }
+#endif
+
+  return stats;
+}
+
+std::vector<trace_event> pool::trace() const {
+  std::vector<trace_event> events;
+
+#if defined(threadpool11_TRACE)
+  const size_type n = workers_->size();
+  for (size_type i = 0; i < n; ++i) {
+    const worker& w = (*workers_)[i];
+    w.trace.copy(w.index, events);
+  }
+  for (auto& event : events) {
+    event.enqueue_time = to_ns(event.enqueue_time);
+    event.start_time = to_ns(event.start_time);
+    event.end_time = to_ns(event.end_time);
+  }
+#endif
+
+  return events;
+}
+
+void pool::dump_trace(std::ostream& out) const {
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+#if defined(threadpool11_TRACE)
+  const std::vector<trace_event> events = trace();
+  bool first = true;
+
+  // relative to the first work posted, the steady clock's epoch is arbitrary
+  std::uint64_t origin = std::numeric_limits<std::uint64_t>::max();
+  for (const auto& event : events) {
+    origin = std::min(origin, event.enqueue_time);
+  }
+
+  const size_type n = workers_->size();
+  for (size_type i = 0; i < n; ++i) {
+    out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i
+        << ",\"args\":{\"name\":\"worker " << i << "\"}}";
+    first = false;
+  }
+
+  for (const auto& event : events) {
+    out << (first ? "" : ",") << "\n{\"name\":\"";
+    write_json(out, event.label != nullptr ? event.label : "work");
+    out << "\",\"cat\":\"work\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.worker << ",\"ts\":";
+    write_us(out, static_cast<std::int64_t>(event.start_time - origin));
+    out << ",\"dur\":";
+    write_us(out, static_cast<std::int64_t>(event.end_time - event.start_time));
+    out << ",\"args\":{\"queued_us\":";
+    write_us(out, static_cast<std::int64_t>(event.start_time - event.enqueue_time));
+    out << ",\"stolen\":" << (event.stolen ? "true" : "false") << "}}";
+    first = false;
+  }
+#endif
+
+  out << "\n]}\n";
+}
+
+bool pool::dump_trace(const std::string& path) const {
+  std::ofstream out(path.c_str());
+  dump_trace(out);
+  out.close();
+  return !out.fail();
+}
+
+pool::strand& pool::keyed_strand(std::size_t hash) {
+  std::call_once(keyed_strands_created_, [this]() {
+    keyed_strands_.reserve(keyed_strand_count);
+    for (size_type i = 0; i < keyed_strand_count; ++i) {
+      keyed_strands_.emplace_back(new strand(*this));
+    }
+  });
+  return *keyed_strands_[hash % keyed_strand_count];
+}
+
+pool::size_type pool::current_node() const {
+  worker* const self = current_worker_;
+  if (self != nullptr && &self->owner == this) {
+    return self->node;
+  }
+  return node_count_ > 1 ? topology::get().current_node() : 0;
+}
+
+pool::size_type pool::local_work_count() const {
+  worker* const self = current_worker_;
+  return self != nullptr && &self->owner == this ? self->deque.size() : 0;
+}
+
+bool pool::pop(worker& self, work_t*& work) {
+  if (++self.taken % starvation_period == 0) {
+    for (size_type level = priority_count; level-- > 0;) {
+      if (pop(self, level, work)) {
+        return true;
+      }
+    }
+  } else {
+    for (size_type level = 0; level < priority_count; ++level) {
+      if (pop(self, level, work)) {
+        return true;
+      }
+    }
+  }
+
+  --self.taken;
+  return false;
+}
+
+bool pool::pop(worker& self, size_type level, work_t*& work) {
+  level_t& l = levels_[level];
+  const bool normal = level == normal_level;
+  const bool queued = l.size.load(std::memory_order_relaxed) != 0;
+
+  // the own node first, then the others, the shards and inboxes count their works themselves
+  if (queued && normal && self.deque.pop(work)) {
+    l.size.fetch_sub(1, std::memory_order_relaxed);
+    work_queue_size_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  if (normal && pop_inbox(self, work)) {
+    self.inbox_since.store(timer_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    return true;
+  }
+
+  if (queued && pop_queue(l, self.node, work)) {
+    l.size.fetch_sub(1, std::memory_order_relaxed);
+    work_queue_size_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  if (normal && pop_shards(self, self.node, work)) {
+    return true;
+  }
+
+  if (queued && ((normal && steal(self, true, work)) || pop_remote_queues(l, self.node, work) ||
+                 (normal && steal(self, false, work)))) {
+    l.size.fetch_sub(1, std::memory_order_relaxed);
+    work_queue_size_.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  return normal && (pop_remote_shards(self, work) || steal_inbox(self, work));
+}
+
+bool pool::pop_queue(level_t& level, size_type node, work_t*& work) { return level.queues[node]->pop(work); }
+
+bool pool::pop_remote_queues(level_t& level, size_type node, work_t*& work) {
+  for (size_type i = 1; i < node_count_; ++i) {
+    if (level.queues[(node + i) % node_count_]->pop(work)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool pool::pop_shards(worker& self, size_type node, work_t*& work) {
+  // start from a random shard so that no producer is always served last
+  const size_type first = self.next_random();
+  for (size_type i = 0; i < shards_per_node_; ++i) {
+    shard_t& shard = *shards_[node * shards_per_node_ + (first + i) % shards_per_node_];
+    if (shard.size.load(std::memory_order_relaxed) != 0 && shard.queue.pop(work)) {
+      shard.size.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool pool::pop_remote_shards(worker& self, work_t*& work) {
+  for (size_type i = 1; i < node_count_; ++i) {
+    if (pop_shards(self, (self.node + i) % node_count_, work)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool pool::pop_inbox(worker& owner, work_t*& work) {
+  if (owner.inbox_size.load(std::memory_order_relaxed) == 0 || !owner.inbox.pop(work)) {
+    return false;
+  }
+
+  // the inbox count goes first so that it never exceeds work_queue_size_
+  owner.inbox_size.fetch_sub(1, std::memory_order_relaxed);
+  inbox_work_count_.fetch_sub(1, std::memory_order_seq_cst);
+  work_queue_size_.fetch_sub(1, std::memory_order_seq_cst);
+  return true;
+}
+
+bool pool::steal_inbox(worker& self, work_t*& work) {
+  if (inbox_work_count_.load(std::memory_order_relaxed) == 0) {
+    return false;
+  }
+
+  const size_type n = workers_->size();
+  const timer_clock::rep stale =
+      timer_clock::now().time_since_epoch().count() - inbox_steal_delay_.load(std::memory_order_relaxed);
+
+  const size_type first = self.next_random() % n;
+  for (size_type i = 0; i < n; ++i) {
+    worker& victim = (*workers_)[(first + i) % n];
+    if (&victim != &self && victim.inbox_size.load(std::memory_order_relaxed) != 0 &&
+        victim.inbox_since.load(std::memory_order_relaxed) <= stale && pop_inbox(victim, work)) {
+#if defined(threadpool11_STATS)
+      add(self.stats.steals, 1);
+#endif
+#if defined(threadpool11_TRACE)
+      self.trace.stolen = true;
+#endif
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool pool::steal(worker& self, bool same_node, work_t*& work) {
+  const size_type n = workers_->size();
+  if (n < 2 || (!same_node && node_count_ < 2)) {
+    return false;
+  }
+
+  // start from a random victim and sweep the rest once
+  const size_type first = self.next_random() % n;
+  for (size_type i = 0; i < n; ++i) {
+    worker& victim = (*workers_)[(first + i) % n];
+    if (&victim != &self && (victim.node == self.node) == same_node && victim.deque.steal(work)) {
+#if defined(threadpool11_STATS)
+      add(self.stats.steals, 1);
+#endif
+#if defined(threadpool11_TRACE)
+      self.trace.stolen = true;
+#endif
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void pool::wait_for_work(worker& self, size_type& idle_rounds, timer_clock::time_point wake_at) {
+  const size_type spin_count = idle_spin_count_.load(std::memory_order_relaxed);
+  const size_type yield_count = idle_yield_count_.load(std::memory_order_relaxed);
+
+  if (idle_rounds < spin_count) {
+    ++idle_rounds;
+    cpu_relax();
+    return;
+  }
+
+  if (idle_rounds < spin_count + yield_count) {
+    ++idle_rounds;
+    std::this_thread::yield();
+    return;
+  }
+
+  const std::uint32_t key = work_signal_.prepare_wait();
+  self.parked.store(true, std::memory_order_seq_cst);
+  // works in the inboxes of the others do not keep this one awake, they are read first to never exceed the rest
+  const size_type inbox_works = inbox_work_count_.load(std::memory_order_seq_cst);
+  if (queued_work_count(std::memory_order_seq_cst) > inbox_works ||
+      self.inbox_size.load(std::memory_order_seq_cst) > 0 ||
+      live_worker_count_.load(std::memory_order_seq_cst) > target_worker_count()) {
+    self.parked.store(false, std::memory_order_relaxed);
+    work_signal_.cancel_wait();
+    return;
+  }
+
+#if defined(threadpool11_STATS)
+  const std::uint64_t park_begin = now_ns();
+#endif
+
+  const timer_clock::time_point next_timer{
+      timer_clock::duration{next_timer_.load(std::memory_order_seq_cst)}};
+  wake_at = std::min(wake_at, next_timer);
+  if (inbox_works > 0) {
+    wake_at = std::min(wake_at, timer_clock::now() + timer_clock::duration{inbox_steal_delay_.load(
+                                                          std::memory_order_relaxed)});
+  }
+  if (wake_at == timer_clock::time_point::max()) {
+    work_signal_.commit_wait(key);
+  } else {
+    work_signal_.commit_wait_for(key, wake_at - timer_clock::now());
+  }
+  self.parked.store(false, std::memory_order_relaxed);
+  idle_rounds = 0;
+
+#if defined(threadpool11_STATS)
+  self.stats.on_park(park_begin, now_ns());
+#else
+  (void)self;
+#endif
+}
+
+bool pool::help(worker& self) {
+  poll_timers();
+
+  work_t* work_ptr;
+  if (!pop(self, work_ptr)) {
+    return false;
+  }
+
+  on_dequeue();
+  consume(self, work_ptr);
+
+  return true;
+}
+
+void pool::consume(worker& self, work_t* work) {
+  // an external work may be freed by running it, e.g. when it resumes a coroutine that finishes
+  if (work->type() == work_t::type_t::EXTERNAL) {
+    execute(self, *work);
+    return;
+  }
+
+  const std::unique_ptr<work_t> owned(work);
+  execute(self, *owned);
+}
+
+void pool::execute(worker& self, work_t& work) {
+#if defined(threadpool11_ENQUEUE_TIME)
+  // an external work may be gone once it has run
+  const std::uint64_t enqueue_time = work.enqueue_time();
+#if defined(threadpool11_TRACE)
+  const char* const label = work.label();
+  const bool stolen = self.trace.stolen;
+  self.trace.stolen = false;
+#endif
+  const std::uint64_t start = now_ticks();
+
+#if defined(threadpool11_STATS)
+  self.stats.on_start(start, enqueue_time);
+#endif
+  work();
+  const std::uint64_t end = now_ticks();
+#if defined(threadpool11_STATS)
+  self.stats.on_finish(start, end);
+#endif
+#if defined(threadpool11_TRACE)
+  self.trace.record(label, enqueue_time, start, end, stolen);
+#endif
+#else
+  (void)self;
+  work();
+#endif
+}
+
+void pool::worker_main(worker& self) {
+  current_worker_ = &self;
+  wait_helper::current() = &self;
+  if (!self.cpus.empty()) {
+    set_thread_affinity(self.cpus);
+  }
+
+  size_type idle_rounds = 0;
+  // when this worker leaves if it keeps finding no work while autoscaling
+  timer_clock::time_point retire_at = timer_clock::time_point::max();
+
+  while (true) {
+    work_t* work_ptr;
+
+    poll_timers();
+
+    while (pop(self, work_ptr)) {
+      idle_rounds = 0;
+      retire_at = timer_clock::time_point::max();
+
+      on_dequeue();
+
+      consume(self, work_ptr);
+
+      maybe_grow();
+
+      if (claim_exit()) {
+        exit_worker(self);
+        return;
+      }
+
+      poll_timers();
+    }
+
+    if (claim_exit()) {
+      exit_worker(self);
+      return;
+    }
+
+    // right after a park, or after running out of work
+    if (idle_rounds == 0 && is_autoscaling()) {
+      const timer_clock::time_point now = timer_clock::now();
+      if (now >= retire_at && retire_idle()) {
+        exit_worker(self);
+        return;
+      }
+      if (now >= retire_at || retire_at == timer_clock::time_point::max()) {
+        retire_at = now + timer_clock::duration{autoscale_keep_alive_.load(std::memory_order_relaxed)};
+      }
+    } else if (!is_autoscaling()) {
+      retire_at = timer_clock::time_point::max();
+    }
+
+#if defined(threadpool11_STATS)
+    self.stats.on_idle();
+#endif
+    wait_for_work(self, idle_rounds, retire_at);
+  }
+}
+
+}
@@ -0,0 +1,84 @@
+#include "threadpool11/thread_cache.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <thread>
+
+namespace threadpool11 {
+
+/**
+ * Lives on the stack of a waiting thread, run hands the task over through it.
+ */
+struct thread_cache::idle_thread {
+  std::function<void()> task;
+  std::condition_variable signal;
+};
+
+thread_cache::thread_cache()
+    : keep_alive_{5000} {
+}
+
+thread_cache& thread_cache::get() {
+  // leaked on purpose, waiting threads may still touch it after static destruction
+  static thread_cache* const instance = new thread_cache;
+  return *instance;
+}
+
+void thread_cache::run(std::function<void()> task) {
+  {
+    std::lock_guard<mutex_t> lock(mutex_);
+    if (!idle_.empty()) {
+      idle_thread* const thread = idle_.back();
+      idle_.pop_back();
+      thread->task = std::move(task);
+      thread->signal.notify_one();
+      return;
+    }
+  }
+
+  std::thread thread{&thread_cache::thread_main, this, std::move(task)};
+  thread.detach();
+}
+
+thread_cache::size_type thread_cache::idle_count() const {
+  std::lock_guard<mutex_t> lock(mutex_);
+  return idle_.size();
+}
+
+void thread_cache::set_keep_alive(std::chrono::milliseconds keep_alive) {
+  keep_alive_.store(keep_alive.count(), std::memory_order_relaxed);
+}
+
+std::chrono::milliseconds thread_cache::get_keep_alive() const {
+  return std::chrono::milliseconds(keep_alive_.load(std::memory_order_relaxed));
+}
+
+void thread_cache::thread_main(std::function<void()> task) {
+  idle_thread self;
+
+  while (true) {
+    task();
+    task = nullptr;
+
+    std::unique_lock<mutex_t> lock(mutex_);
+    idle_.push_back(&self);
+
+    const auto deadline = std::chrono::steady_clock::now() + get_keep_alive();
+    while (!self.task) {
+      if (self.signal.wait_until(lock, deadline) == std::cv_status::timeout) {
+        break;
+      }
+    }
+
+    // run pops a thread before handing it a task, so a thread without one is still in the list
+    if (!self.task) {
+      idle_.erase(std::find(idle_.begin(), idle_.end(), &self));
+      return;
+    }
+
+    task = std::move(self.task);
+    self.task = nullptr;
+  }
+}
+
+}
@@ -0,0 +1,151 @@
+#include "threadpool11/timer_wheel.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace threadpool11 {
+
+constexpr unsigned timer_wheel::slot_bits;
+constexpr timer_wheel::size_type timer_wheel::slot_count;
+constexpr timer_wheel::size_type timer_wheel::level_count;
+
+namespace {
+
+constexpr std::uint64_t slot_mask = timer_wheel::slot_count - 1;
+
+/**
+ * Number of ticks the whole wheel spans.
+ */
+constexpr std::uint64_t horizon = std::uint64_t{1} << (timer_wheel::slot_bits * timer_wheel::level_count);
+
+}
+
+timer_wheel::timer_wheel(clock::time_point origin)
+    : origin_{origin}
+    , now_tick_{0}
+    , next_tick_{std::numeric_limits<tick_type>::max()}
+    , size_{0} {
+  std::fill(&slots_[0][0], &slots_[0][0] + level_count * slot_count, nullptr);
+}
+
+timer_wheel::~timer_wheel() {
+  for (size_type level = 0; level < level_count; ++level) {
+    for (size_type slot = 0; slot < slot_count; ++slot) {
+      for (entry* e = slots_[level][slot]; e != nullptr;) {
+        entry* const next = e->next;
+        delete e;
+        e = next;
+      }
+    }
+  }
+}
+
+void timer_wheel::add(clock::time_point deadline, std::unique_ptr<work> task) {
+  tick_type tick = 0;
+  if (deadline > origin_) {
+    // round up, a timer must not expire early
+    const auto elapsed = deadline - origin_;
+    const auto ticks = std::chrono::duration_cast<resolution>(elapsed);
+    tick = static_cast<tick_type>(ticks.count()) + (ticks < elapsed ? 1 : 0);
+  }
+
+  insert(new entry{nullptr, std::max(tick, now_tick_ + 1), std::move(task)});
+  ++size_;
+}
+
+void timer_wheel::advance(clock::time_point now, std::vector<std::unique_ptr<work>>& expired) {
+  if (now <= origin_) {
+    return;
+  }
+
+  const tick_type target = static_cast<tick_type>(std::chrono::duration_cast<resolution>(now - origin_).count());
+
+  while (now_tick_ < target) {
+    // nothing expires or cascades before next_tick_, jump over the empty ticks
+    if (next_tick_ > now_tick_ + 1) {
+      now_tick_ = std::min(target, next_tick_ - 1);
+      continue;
+    }
+
+    ++now_tick_;
+
+    for (size_type level = 1; level < level_count; ++level) {
+      if ((now_tick_ & ((tick_type{1} << (slot_bits * level)) - 1)) != 0) {
+        break;
+      }
+      cascade(level);
+    }
+
+    entry*& slot = slots_[0][now_tick_ & slot_mask];
+    for (entry* e = slot; e != nullptr;) {
+      entry* const next = e->next;
+      expired.push_back(std::move(e->task));
+      delete e;
+      --size_;
+      e = next;
+    }
+    slot = nullptr;
+
+    if (next_tick_ <= now_tick_) {
+      next_tick_ = compute_next_tick();
+    }
+  }
+}
+
+timer_wheel::clock::time_point timer_wheel::next_expiry() const {
+  if (next_tick_ == std::numeric_limits<tick_type>::max()) {
+    return clock::time_point::max();
+  }
+  return origin_ + resolution(static_cast<resolution::rep>(next_tick_));
+}
+
+void timer_wheel::insert(entry* e) {
+  // timers beyond the horizon wait in the last slot of the top level
+  const tick_type tick = std::min(e->tick, now_tick_ + horizon - 1);
+  const tick_type delta = tick - now_tick_;
+
+  size_type level = 0;
+  while (level + 1 < level_count && delta >= (tick_type{1} << (slot_bits * (level + 1)))) {
+    ++level;
+  }
+
+  const unsigned shift = static_cast<unsigned>(slot_bits * level);
+  entry*& slot = slots_[level][(tick >> shift) & slot_mask];
+  e->next = slot;
+  slot = e;
+
+  // the slot is expired or cascaded once its first tick is reached
+  next_tick_ = std::min(next_tick_, (tick >> shift) << shift);
+}
+
+void timer_wheel::cascade(size_type level) {
+  const unsigned shift = static_cast<unsigned>(slot_bits * level);
+  entry*& slot = slots_[level][(now_tick_ >> shift) & slot_mask];
+
+  entry* e = slot;
+  slot = nullptr;
+  while (e != nullptr) {
+    entry* const next = e->next;
+    insert(e);
+    e = next;
+  }
+}
+
+timer_wheel::tick_type timer_wheel::compute_next_tick() const {
+  tick_type next = std::numeric_limits<tick_type>::max();
+
+  for (size_type level = 0; level < level_count; ++level) {
+    const unsigned shift = static_cast<unsigned>(slot_bits * level);
+    const tick_type base = now_tick_ >> shift;
+    for (tick_type k = 1; k <= slot_count; ++k) {
+      if (slots_[level][(base + k) & slot_mask] != nullptr) {
+        next = std::min(next, (base + k) << shift);
+        break;
+      }
+    }
+  }
+
+  return next;
+}
+
+}
@@ -0,0 +1,73 @@
+#include <threadpool11/coroutine.hpp>
+#include <threadpool11/pool.hpp>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using pool = threadpool11::pool;
+using size_type = threadpool11::pool::size_type;
+
+template <class T = void>
+using task = threadpool11::task<T>;
+
+namespace {
+
+task<std::thread::id> worker_id(pool& p) {
+  co_await p.schedule();
+  co_return std::this_thread::get_id();
+}
+
+task<size_type> fib(pool& p, size_type n) {
+  co_await p.schedule();
+  if (n < 2) {
+    co_return n;
+  }
+  const size_type a = co_await fib(p, n - 1);
+  const size_type b = co_await fib(p, n - 2);
+  co_return a + b;
+}
+
+task<std::string> fail(pool& p) {
+  co_await p.schedule();
+  throw std::runtime_error("fail");
+}
+
+task<> count(pool& p, std::atomic<size_type>& counter) {
+  co_await p.schedule();
+  ++counter;
+}
+
+}
+
+TEST(coroutine, schedule) {
+  pool p(2);
+  ASSERT_NE(std::this_thread::get_id(), threadpool11::sync_wait(worker_id(p)));
+}
+
+TEST(coroutine, task_chain) {
+  pool p(4);
+  ASSERT_EQ(6765u, threadpool11::sync_wait(fib(p, 20)));
+}
+
+TEST(coroutine, exception) {
+  pool p(2);
+  ASSERT_THROW(threadpool11::sync_wait(fail(p)), std::runtime_error);
+}
+
+TEST(coroutine, many) {
+  constexpr size_type n = 10000;
+  pool p(4);
+  std::atomic<size_type> counter{0};
+  auto all = [](pool& p, std::atomic<size_type>& counter) -> task<> {
+    for (size_type i = 0; i < n; ++i) {
+      co_await count(p, counter);
+    }
+  };
+  threadpool11::sync_wait(all(p, counter));
+  ASSERT_EQ(n, counter.load());
+}
@@ -1,8 +1,26 @@
+#include <threadpool11/algorithm.hpp>
+#include <threadpool11/deque.hpp>
 #include <threadpool11/pool.hpp>
+#include <threadpool11/strand.hpp>
+#include <threadpool11/task_group.hpp>
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <future>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
 using pool = threadpool11::pool;
 using size_type = threadpool11::pool::size_type;
@@ -16,7 +34,7 @@ TEST(pool, ctor_dtor_joinall) {
 
 TEST(pool, post_work) {
   constexpr size_type count = 150000;
-  std::vector<std::future<size_type>> values;
+  std::vector<threadpool11::future<size_type>> values;
   values.reserve(count);
   pool p;
   for (size_type i = 0; i < count; ++i) {
@@ -42,3 +60,1005 @@ TEST(pool, post_work_no_future) {
   }
 }
 
+
+TEST(pool, post_work_deduced) {
+  constexpr size_type count = 150000;
+  std::vector<threadpool11::future<size_type>> values;
+  values.reserve(count);
+  pool p;
+  for (size_type i = 0; i < count; ++i) {
+    values.emplace_back(p.post_work([i]() { return i + 1; }));
+  }
+  for (size_type i = 0; i < count; ++i) {
+    ASSERT_EQ(i + 1, values[i].get());
+  }
+}
+
+TEST(pool, post_work_large_callable) {
+  std::array<size_type, 32> numbers;
+  std::iota(numbers.begin(), numbers.end(), 1);
+
+  pool p;
+  auto future = p.post_work([numbers]() { return std::accumulate(numbers.begin(), numbers.end(), size_type{0}); });
+  ASSERT_EQ(32u * 33u / 2u, future.get());
+}
+
+TEST(pool, post_work_exception) {
+  pool p;
+  auto future = p.post_work([]() -> int { throw std::runtime_error("error"); });
+  ASSERT_THROW(future.get(), std::runtime_error);
+}
+
+TEST(pool, idle_policy) {
+  pool p(2);
+  p.set_idle_policy(pool::idle_policy(0, 0));
+  ASSERT_EQ(0u, p.get_idle_policy().spin_count);
+  ASSERT_EQ(0u, p.get_idle_policy().yield_count);
+
+  // workers park right away, every post has to wake one up
+  for (size_type i = 0; i < 1000; ++i) {
+    ASSERT_EQ(i, p.post_work([i]() { return i; }).get());
+  }
+
+  p.set_idle_policy(pool::idle_policy(1000, 100));
+  ASSERT_EQ(1000u, p.get_idle_policy().spin_count);
+  for (size_type i = 0; i < 1000; ++i) {
+    ASSERT_EQ(i, p.post_work([i]() { return i; }).get());
+  }
+}
+
+TEST(pool, worker_count) {
+  pool p(4);
+  for (size_type i = 0; i < 100; ++i) {
+    p.decrease_worker_count(3);
+    p.increase_worker_count(2);
+    p.decrease_worker_count(1, pool::method_t::SYNC);
+    p.increase_worker_count(2);
+  }
+  ASSERT_EQ(4u, p.get_worker_count());
+  for (size_type i = 0; i < 1000; ++i) {
+    ASSERT_EQ(i, p.post_work([i]() { return i; }).get());
+  }
+
+  p.set_worker_count(0, pool::method_t::SYNC);
+  ASSERT_EQ(0u, p.get_worker_count());
+  auto future = p.post_work([]() { return 1; });
+  p.set_worker_count(1);
+  ASSERT_EQ(1, future.get());
+}
+
+TEST(pool, concurrent_resize) {
+  pool p(2);
+  std::vector<std::thread> threads;
+  for (size_type t = 0; t < 4; ++t) {
+    threads.emplace_back([&p]() {
+      for (size_type i = 0; i < 200; ++i) {
+        p.set_worker_count(i % 2 == 0 ? 5 : 3);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  // each thread last asks for 3 workers, increasing by a count read earlier would overshoot
+  ASSERT_EQ(3u, p.get_worker_count());
+  ASSERT_EQ(1, p.post_work([]() { return 1; }).get());
+}
+
+TEST(pool, autoscale) {
+  pool p(1);
+  p.set_autoscale_policy(pool::autoscale_policy(1, 4, std::chrono::milliseconds(20), 1, std::chrono::microseconds(0)));
+  ASSERT_TRUE(p.is_autoscaling());
+  ASSERT_EQ(4u, p.get_autoscale_policy().max_workers);
+
+  std::vector<threadpool11::future<void>> futures;
+  for (size_type i = 0; i < 64; ++i) {
+    futures.emplace_back(p.post_work([]() { std::this_thread::sleep_for(std::chrono::milliseconds(2)); }));
+  }
+  for (auto& future : futures) {
+    future.get();
+  }
+  ASSERT_EQ(4u, p.get_worker_count());
+
+  // idle workers leave after the keep alive time, down to min_workers
+  for (size_type i = 0; i < 200 && p.get_worker_count() > 1; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_EQ(1u, p.get_worker_count());
+  ASSERT_EQ(7, p.post_work([]() { return 7; }).get());
+
+  p.disable_autoscale();
+  ASSERT_FALSE(p.is_autoscaling());
+}
+
+TEST(pool, lazy_start) {
+  pool p(2);
+  ASSERT_EQ(2u, p.get_worker_count());
+  p.set_worker_count(1);
+  ASSERT_EQ(1, p.post_work([]() { return 1; }).get());
+
+  pool q(0);
+  q.increase_worker_count(1);
+  auto future = q.post_after(std::chrono::milliseconds(1), []() { return 2; });
+  ASSERT_EQ(2, future.get());
+}
+
+TEST(thread_cache, reuse) {
+  threadpool11::thread_cache& cache = threadpool11::thread_cache::get();
+  ASSERT_EQ(5000, cache.get_keep_alive().count());
+
+  // short-lived pools run on the threads of the ones before them
+  constexpr size_type count = 200;
+  std::vector<std::thread::id> ids;
+  for (size_type i = 0; i < count; ++i) {
+    pool p(1);
+    ids.push_back(p.post_work([]() { return std::this_thread::get_id(); }).get());
+  }
+  std::sort(ids.begin(), ids.end());
+  ASSERT_LT(std::distance(ids.begin(), std::unique(ids.begin(), ids.end())), static_cast<std::ptrdiff_t>(count / 2));
+}
+
+TEST(pool, capacity) {
+  pool p(1);
+  p.set_capacity(2);
+  ASSERT_EQ(2u, p.get_capacity());
+
+  // keep the only worker busy so that nothing leaves the queue
+  std::promise<void> started;
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  p.post_work([&started, released]() {
+    started.set_value();
+    released.wait();
+  }, pool::no_future_tag);
+  started.get_future().wait();
+
+  ASSERT_TRUE(p.try_post_work([]() {}, pool::no_future_tag));
+  auto future = p.try_post_work([]() { return 1; });
+  ASSERT_TRUE(future.valid());
+  ASSERT_FALSE(p.try_post_work([]() {}, pool::no_future_tag));
+  ASSERT_FALSE(p.post_work_for(std::chrono::milliseconds(10), []() { return 2; }).valid());
+  ASSERT_EQ(2u, p.get_work_queue_size());
+
+  std::atomic<bool> posted{false};
+  std::thread producer([&p, &posted]() {
+    p.post_work([]() {}, pool::no_future_tag);
+    posted = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  ASSERT_FALSE(posted.load());
+
+  release.set_value();
+  producer.join();
+  ASSERT_TRUE(posted.load());
+  ASSERT_EQ(1, future.get());
+  ASSERT_EQ(3, p.post_work_for(std::chrono::seconds(10), []() { return 3; }).get());
+}
+
+TEST(pool, cancellation) {
+  pool p(1);
+
+  std::promise<void> started;
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  p.post_work([&started, released]() {
+    started.set_value();
+    released.wait();
+  }, pool::no_future_tag);
+  started.get_future().wait();
+
+  threadpool11::cancellation_source source;
+  std::atomic<int> runs{0};
+  auto cancelled = p.post_work(source.token(), [&runs]() { return ++runs; });
+  p.post_work(source.token(), [&runs]() { ++runs; }, pool::no_future_tag);
+  auto kept = p.post_work(threadpool11::cancellation_token(), []() { return 1; });
+  source.cancel();
+  ASSERT_TRUE(source.is_cancelled());
+
+  release.set_value();
+  ASSERT_THROW(cancelled.get(), threadpool11::operation_cancelled);
+  ASSERT_EQ(1, kept.get());
+  ASSERT_EQ(0, runs.load());
+
+  // running works only stop if they poll their token
+  threadpool11::cancellation_source other;
+  const threadpool11::cancellation_token token = other.token();
+  auto polling = p.post_work(token, [token]() {
+    while (true) {
+      token.throw_if_cancelled();
+      std::this_thread::yield();
+    }
+  });
+  other.cancel();
+  ASSERT_THROW(polling.get(), threadpool11::operation_cancelled);
+}
+
+TEST(strand, order) {
+  constexpr size_type count = 100000;
+  pool p(4);
+  pool::strand s(p);
+
+  // not atomic on purpose, the strand never runs two of its works at once
+  std::vector<size_type> order;
+  order.reserve(count);
+  std::vector<threadpool11::future<void>> futures;
+  std::thread producer([&s, &order]() {
+    for (size_type i = 0; i < count / 2; ++i) {
+      s.post([&order, i]() { order.push_back(i); }, pool::no_future_tag);
+    }
+  });
+  for (size_type i = count / 2; i < count; ++i) {
+    futures.emplace_back(s.post([&order, &s, i]() {
+      EXPECT_TRUE(s.running_in_this_thread());
+      order.push_back(i);
+    }));
+  }
+  producer.join();
+  for (auto& future : futures) {
+    future.get();
+  }
+  p.join_all();
+
+  ASSERT_EQ(count, order.size());
+  size_type first = 0;
+  size_type second = count / 2;
+  for (const size_type i : order) {
+    ASSERT_EQ(i < count / 2 ? first++ : second++, i);
+  }
+  ASSERT_FALSE(s.running_in_this_thread());
+}
+
+TEST(strand, fairness) {
+  constexpr size_type count = 4 * pool::strand::batch_size;
+  pool p(1);
+  pool::strand s(p);
+
+  // posted from the only worker, the plain work sits in its deque below the strand
+  size_type done = 0;
+  threadpool11::future<size_type> seen;
+  threadpool11::future<void> last;
+  p.post_work([&]() {
+    seen = p.post_work([&done]() { return done; });
+    for (size_type i = 0; i < count; ++i) {
+      last = s.post([&done]() { ++done; });
+    }
+  }).get();
+
+  ASSERT_EQ(pool::strand::batch_size, seen.get());
+  last.get();
+  ASSERT_EQ(count, done);
+}
+
+TEST(pool, post_keyed) {
+  constexpr size_type keys = 16;
+  constexpr size_type count = 1000;
+  pool p(4);
+
+  std::vector<std::vector<size_type>> seen(keys);
+  std::vector<threadpool11::future<size_type>> futures;
+  for (size_type i = 0; i < count; ++i) {
+    for (size_type key = 0; key < keys; ++key) {
+      futures.emplace_back(p.post_keyed(key, [&seen, key, i]() {
+        seen[key].push_back(i);
+        return key;
+      }));
+    }
+  }
+  for (size_type i = 0; i < futures.size(); ++i) {
+    ASSERT_EQ(i % keys, futures[i].get());
+  }
+  for (const auto& values : seen) {
+    ASSERT_EQ(count, values.size());
+    for (size_type i = 0; i < count; ++i) {
+      ASSERT_EQ(i, values[i]);
+    }
+  }
+}
+
+TEST(pool, many_producers) {
+  pool p(2);
+
+  constexpr size_type producer_count = 8;
+  constexpr size_type work_count = 2000;
+
+  std::atomic<size_type> done{0};
+  std::vector<std::thread> producers;
+  for (size_type i = 0; i < producer_count; ++i) {
+    producers.emplace_back([&p, &done]() {
+      std::vector<threadpool11::future<size_type>> futures;
+      for (size_type j = 0; j < work_count; ++j) {
+        if (j % 2 == 0) {
+          p.post_work([&done]() { ++done; }, pool::no_future_tag);
+        } else {
+          futures.emplace_back(p.post_work([&done, j]() {
+            ++done;
+            return j;
+          }));
+        }
+      }
+      for (size_type j = 0; j < futures.size(); ++j) {
+        ASSERT_EQ(2 * j + 1, futures[j].get());
+      }
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+
+  while (done.load() != producer_count * work_count) {
+    std::this_thread::yield();
+  }
+  ASSERT_EQ(0u, p.get_work_queue_size());
+}
+
+TEST(pool, post_to) {
+  pool p(3);
+  p.set_idle_policy(pool::idle_policy(64, 8, std::chrono::seconds(10)));
+  ASSERT_EQ(pool::no_worker, p.current_worker_index());
+
+  for (size_type i = 0; i < 3; ++i) {
+    ASSERT_EQ(i, p.post_to(i, [&p]() { return p.current_worker_index(); }).get());
+  }
+
+  const size_type index = p.post_near(42, [&p]() { return p.current_worker_index(); }).get();
+  ASSERT_EQ(index, p.post_near(42, [&p]() { return p.current_worker_index(); }).get());
+}
+
+TEST(pool, post_to_steal) {
+  pool p(2);
+  p.set_idle_policy(pool::idle_policy(64, 8, std::chrono::milliseconds(1)));
+
+  // the other worker takes the second work once the first one keeps worker 0 busy for long enough
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  p.post_to(0, [released]() { released.wait(); }, pool::no_future_tag);
+  ASSERT_EQ(1u, p.post_to(0, [&p]() { return p.current_worker_index(); }).get());
+  release.set_value();
+}
+
+TEST(pool, post_blocking) {
+  pool p(1);
+
+  // the only worker blocks, the compensating one runs the rest meanwhile
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  auto blocked = p.post_blocking([released]() {
+    released.wait();
+    return 1;
+  });
+  ASSERT_EQ(2, p.post_work([]() { return 2; }).get());
+  ASSERT_EQ(1u, p.get_worker_count());
+
+  release.set_value();
+  ASSERT_EQ(1, blocked.get());
+}
+
+TEST(pool, blocking_scope) {
+  pool p(1);
+
+  // a scope outside the pool does nothing
+  { pool::blocking_scope scope(p); }
+
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  auto blocked = p.post_work([&p, released]() {
+    pool::blocking_scope outer(p);
+    pool::blocking_scope inner(p);
+    released.wait();
+  });
+  ASSERT_EQ(2, p.post_work([]() { return 2; }).get());
+
+  release.set_value();
+  blocked.get();
+  ASSERT_EQ(3, p.post_work([]() { return 3; }).get());
+}
+
+TEST(pool, priority) {
+  using priority_t = pool::priority_t;
+  constexpr size_type count = 10;
+
+  pool p(1);
+  std::atomic<bool> blocked{true};
+  p.post_work([&blocked]() {
+    while (blocked.load()) {
+      std::this_thread::yield();
+    }
+  }, pool::no_future_tag);
+  while (p.get_work_queue_size() != 0) {
+    std::this_thread::yield();
+  }
+
+  std::vector<priority_t> order;
+  for (size_type i = 0; i < count; ++i) {
+    p.post_work(priority_t::LOW, [&order]() { order.push_back(priority_t::LOW); }, pool::no_future_tag);
+    p.post_work(priority_t::NORMAL, [&order]() { order.push_back(priority_t::NORMAL); }, pool::no_future_tag);
+    p.post_work(priority_t::HIGH, [&order]() { order.push_back(priority_t::HIGH); }, pool::no_future_tag);
+  }
+  ASSERT_EQ(count, p.get_work_queue_size(priority_t::LOW));
+  ASSERT_EQ(count, p.get_work_queue_size(priority_t::NORMAL));
+  ASSERT_EQ(count, p.get_work_queue_size(priority_t::HIGH));
+  ASSERT_EQ(3 * count, p.get_work_queue_size());
+
+  blocked = false;
+  p.post_work(priority_t::LOW, []() {}).get();
+
+  ASSERT_EQ(3 * count, order.size());
+  for (size_type i = 0; i < count; ++i) {
+    ASSERT_EQ(priority_t::HIGH, order[i]);
+    ASSERT_EQ(priority_t::NORMAL, order[count + i]);
+    ASSERT_EQ(priority_t::LOW, order[2 * count + i]);
+  }
+}
+
+TEST(pool, priority_starvation) {
+  using priority_t = pool::priority_t;
+
+  pool p(1);
+  std::atomic<bool> low_done{false};
+  p.post_work(priority_t::LOW, [&low_done]() { low_done = true; }, pool::no_future_tag);
+
+  // a steady flow of high priority works must not keep the low priority one from running
+  std::function<void()> flood;
+  flood = [&]() {
+    if (!low_done.load()) {
+      p.post_work(priority_t::HIGH, flood, pool::no_future_tag);
+    }
+  };
+  p.post_work(priority_t::HIGH, flood, pool::no_future_tag);
+
+  while (!low_done.load()) {
+    std::this_thread::yield();
+  }
+}
+
+TEST(pool, post_n) {
+  constexpr size_type count = 150000;
+  std::vector<size_type> values(count, 0);
+  pool p;
+  p.post_n(count, [&values](size_type i) { values[i] = i + 1; }).get();
+  for (size_type i = 0; i < count; ++i) {
+    ASSERT_EQ(i + 1, values[i]);
+  }
+}
+
+TEST(pool, post_bulk) {
+  constexpr size_type count = 1000;
+  std::atomic<size_type> sum{0};
+  std::vector<std::function<void()>> callables;
+  for (size_type i = 0; i < count; ++i) {
+    callables.emplace_back([&sum, i]() { sum.fetch_add(i); });
+  }
+  pool p;
+  p.post_bulk(callables.begin(), callables.end()).get();
+  ASSERT_EQ(count * (count - 1) / 2, sum.load());
+}
+
+TEST(pool, post_n_exception) {
+  pool p;
+  auto future = p.post_n(100, [](size_type i) {
+    if (i == 50) {
+      throw std::runtime_error("error");
+    }
+  });
+  ASSERT_THROW(future.get(), std::runtime_error);
+  ASSERT_NO_THROW(p.post_n(0, [](size_type) {}).get());
+}
+
+TEST(pool, parallel_for) {
+  constexpr size_type count = 100000;
+  pool p;
+
+  std::vector<size_type> values(count, 0);
+  p.parallel_for(size_type{0}, count, [&values](size_type i) { values[i] += i + 1; });
+  p.parallel_for(size_type{0}, count, [&values](size_type i) { values[i] += i + 1; },
+                 threadpool11::static_partitioner());
+  p.parallel_for(size_type{0}, count, [&values](size_type i) { values[i] += i + 1; },
+                 threadpool11::dynamic_partitioner(64));
+  p.parallel_for(size_type{0}, count, [&values](size_type i) { values[i] += i + 1; },
+                 threadpool11::adaptive_partitioner(1000));
+  for (size_type i = 0; i < count; ++i) {
+    ASSERT_EQ(4 * (i + 1), values[i]);
+  }
+
+  p.parallel_for(10, 0, [](int) { FAIL(); });
+  ASSERT_THROW(p.parallel_for(0, 1000, [](int i) {
+    if (i == 999) {
+      throw std::runtime_error("error");
+    }
+  }), std::runtime_error);
+}
+
+TEST(pool, parallel_for_spread) {
+  constexpr size_type count = 64;
+  constexpr size_type worker_count = 4;
+  pool p(worker_count);
+
+  // iterations that sleep leave the CPU to the other workers even on a single core
+  std::vector<std::atomic<size_type>> runs(worker_count);
+  for (auto& n : runs) {
+    n.store(0);
+  }
+  p.parallel_for(size_type{0}, count, [&p, &runs](size_type) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    runs[p.current_worker_index()].fetch_add(1);
+  });
+
+  size_type total = 0;
+  for (auto& n : runs) {
+    ASSERT_GT(n.load(), 0u);
+    ASSERT_LT(n.load(), count / 2);
+    total += n.load();
+  }
+  ASSERT_EQ(count, total);
+}
+
+TEST(pool, parallel_reduce) {
+  constexpr size_type count = 100000;
+  constexpr size_type expected = count * (count - 1) / 2;
+  pool p;
+
+  const auto body = [](size_type i) { return i; };
+  const auto combine = [](size_type a, size_type b) { return a + b; };
+  ASSERT_EQ(expected, p.parallel_reduce(size_type{0}, count, size_type{0}, body, combine));
+  ASSERT_EQ(expected, p.parallel_reduce(size_type{0}, count, size_type{0}, body, combine,
+                                        threadpool11::static_partitioner()));
+  ASSERT_EQ(expected, p.parallel_reduce(size_type{0}, count, size_type{0}, body, combine,
+                                        threadpool11::dynamic_partitioner(100)));
+  ASSERT_EQ(expected, p.parallel_reduce(size_type{0}, count, size_type{0}, body, combine,
+                                        threadpool11::adaptive_partitioner(100)));
+  ASSERT_EQ(7u, p.parallel_reduce(size_type{0}, size_type{0}, size_type{7}, body, combine));
+}
+
+TEST(pool, post_after) {
+  using clock = std::chrono::steady_clock;
+  pool p;
+  const auto start = clock::now();
+  auto late = p.post_after(std::chrono::milliseconds(60), []() { return clock::now(); });
+  auto early = p.post_after(std::chrono::milliseconds(20), []() { return clock::now(); });
+  auto past = p.post_at(clock::now() - std::chrono::seconds(1), []() { return 1; });
+
+  const auto early_time = early.get();
+  const auto late_time = late.get();
+  ASSERT_GE(early_time - start, std::chrono::milliseconds(20));
+  ASSERT_GE(late_time - start, std::chrono::milliseconds(60));
+  ASSERT_LT(early_time, late_time);
+  ASSERT_EQ(1, past.get());
+}
+
+TEST(pool, post_after_many) {
+  constexpr size_type count = 10000;
+  std::atomic<size_type> fired{0};
+  pool p;
+  for (size_type i = 0; i < count; ++i) {
+    p.post_after(std::chrono::milliseconds(i % 100), [&fired]() { fired.fetch_add(1, std::memory_order_relaxed); },
+                 pool::no_future_tag);
+  }
+  while (fired.load() != count) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(count, fired.load());
+}
+
+TEST(pool, post_every) {
+  pool p;
+  std::atomic<int> runs{0};
+  threadpool11::promise<void> done;
+  auto future = done.get_future();
+  p.post_every(std::chrono::milliseconds(5), [&runs, &done]() {
+    if (++runs == 5) {
+      done.set_value();
+      return false;
+    }
+    return true;
+  });
+  future.get();
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  ASSERT_EQ(5, runs.load());
+  ASSERT_THROW(p.post_every(std::chrono::milliseconds(0), []() {}), std::invalid_argument);
+}
+
+TEST(placement, assign) {
+  const threadpool11::topology topology{{{0, 1, 2, 3}, {4, 5, 6, 7}}};
+  using policy_t = threadpool11::placement::policy_t;
+
+  const threadpool11::placement compact{policy_t::COMPACT};
+  ASSERT_EQ(std::vector<unsigned>{1}, compact.assign(1, topology).cpus);
+  ASSERT_EQ(0u, compact.assign(1, topology).node);
+  ASSERT_EQ(std::vector<unsigned>{5}, compact.assign(5, topology).cpus);
+  ASSERT_EQ(1u, compact.assign(5, topology).node);
+  ASSERT_EQ(std::vector<unsigned>{0}, compact.assign(8, topology).cpus);
+
+  const threadpool11::placement scatter{policy_t::SCATTER};
+  ASSERT_EQ(std::vector<unsigned>{0}, scatter.assign(0, topology).cpus);
+  ASSERT_EQ(std::vector<unsigned>{4}, scatter.assign(1, topology).cpus);
+  ASSERT_EQ(std::vector<unsigned>{1}, scatter.assign(2, topology).cpus);
+
+  const threadpool11::placement numa{policy_t::NUMA_NODE};
+  ASSERT_EQ(topology.node_cpus(1), numa.assign(3, topology).cpus);
+  ASSERT_EQ(1u, numa.assign(3, topology).node);
+
+  const threadpool11::placement list{std::vector<unsigned>{6, 2}};
+  ASSERT_EQ(std::vector<unsigned>{2}, list.assign(3, topology).cpus);
+  ASSERT_EQ(1u, list.assign(0, topology).node);
+
+  ASSERT_TRUE(threadpool11::placement().assign(0, topology).cpus.empty());
+
+  const threadpool11::placement empty_list{policy_t::CPU_LIST};
+  ASSERT_EQ(policy_t::NONE, empty_list.policy());
+  ASSERT_TRUE(empty_list.assign(3, topology).cpus.empty());
+}
+
+TEST(placement, pool) {
+  const auto& topology = threadpool11::topology::get();
+  pool p(2, threadpool11::placement::policy_t::COMPACT);
+  std::atomic<size_type> counter{0};
+  p.post_n(1000, [&counter](size_type) { counter.fetch_add(1, std::memory_order_relaxed); }).get();
+  ASSERT_EQ(1000u, counter.load());
+
+  const unsigned cpu = topology.node_cpus(0).front();
+  pool pinned(1, threadpool11::placement{std::vector<unsigned>{cpu}});
+  ASSERT_EQ(topology.node_of(cpu), pinned.post_work([&topology]() { return topology.current_node(); }).get());
+}
+
+TEST(future, wait_for) {
+  pool p;
+  auto future = p.post_work([]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    return 1;
+  });
+  ASSERT_EQ(std::future_status::timeout, future.wait_for(std::chrono::milliseconds(1)));
+  ASSERT_EQ(std::future_status::ready, future.wait_for(std::chrono::seconds(10)));
+  ASSERT_TRUE(future.is_ready());
+  ASSERT_EQ(1, future.get());
+  ASSERT_FALSE(future.valid());
+}
+
+TEST(future, broken_promise) {
+  threadpool11::future<int> future;
+  {
+    threadpool11::promise<int> promise;
+    future = promise.get_future();
+  }
+  ASSERT_THROW(future.get(), threadpool11::future_error);
+}
+
+TEST(future, move_only_value) {
+  threadpool11::promise<std::unique_ptr<int>> promise;
+  auto future = promise.get_future();
+  std::thread thread([&promise]() { promise.set_value(std::unique_ptr<int>(new int(5))); });
+  ASSERT_EQ(5, *future.get());
+  thread.join();
+}
+
+TEST(future, reference) {
+  pool p;
+  int value = 41;
+  int& result = p.post_work([&value]() -> int& { return value; }).get();
+  ASSERT_EQ(&value, &result);
+
+  auto future = p.post_work([&value]() -> int& { return value; }).then(p, [](int& result) { return ++result; });
+  ASSERT_EQ(42, future.get());
+  ASSERT_EQ(42, value);
+
+  threadpool11::promise<const int&> promise;
+  promise.set_value(value);
+  ASSERT_EQ(&value, &promise.get_future().get());
+}
+
+TEST(future, then) {
+  pool p;
+  auto future = p.post_work([]() { return 20; })
+                    .then(p, [](int value) { return value + 1; })
+                    .then(p, [](int value) { return value * 2; });
+  ASSERT_EQ(42, future.get());
+
+  auto done = p.post_work([]() {}).then(p, []() { return std::string("done"); });
+  ASSERT_EQ("done", done.get());
+}
+
+TEST(future, then_exception) {
+  pool p;
+  std::atomic<bool> called{false};
+  auto future = p.post_work([]() -> int { throw std::runtime_error("error"); })
+                    .then(p, [&called](int value) {
+                      called = true;
+                      return value;
+                    });
+  ASSERT_THROW(future.get(), std::runtime_error);
+  ASSERT_FALSE(called.load());
+}
+
+TEST(task_group, wait) {
+  pool p(2);
+  threadpool11::task_group group(p);
+
+  std::atomic<size_type> done{0};
+  for (size_type i = 0; i < 1000; ++i) {
+    group.run([&done]() { ++done; });
+  }
+  group.wait();
+  ASSERT_EQ(1000u, done.load());
+  ASSERT_EQ(0u, group.outstanding());
+
+  // nested groups wait on the workers while helping
+  group.run([&p, &done]() {
+    threadpool11::task_group inner(p);
+    for (size_type i = 0; i < 100; ++i) {
+      inner.run([&done]() { ++done; });
+    }
+    inner.wait();
+  });
+  group.wait();
+  ASSERT_EQ(1100u, done.load());
+
+  group.run([]() { throw std::runtime_error("task_group"); });
+  ASSERT_THROW(group.wait(), std::runtime_error);
+  group.run([&done]() { ++done; });
+  group.wait();
+  ASSERT_EQ(1101u, done.load());
+}
+
+TEST(future, when_all_when_any) {
+  pool p(2);
+
+  std::vector<threadpool11::future<size_type>> futures;
+  for (size_type i = 0; i < 10; ++i) {
+    futures.push_back(p.post_work([i]() { return i; }));
+  }
+  auto all = threadpool11::when_all(std::move(futures)).get();
+  ASSERT_EQ(10u, all.size());
+  for (size_type i = 0; i < all.size(); ++i) {
+    ASSERT_EQ(i, all[i].get());
+  }
+
+  threadpool11::promise<size_type> never;
+  std::vector<threadpool11::future<size_type>> some;
+  some.push_back(never.get_future());
+  some.push_back(p.post_work([]() { return size_type{7}; }));
+  auto any = threadpool11::when_any(std::move(some)).get();
+  ASSERT_EQ(1u, any.index);
+  ASSERT_EQ(7u, any.futures[1].get());
+
+  ASSERT_EQ(std::numeric_limits<std::size_t>::max(),
+            threadpool11::when_any(std::vector<threadpool11::future<size_type>>()).get().index);
+}
+
+TEST(task_graph, diamond) {
+  pool p(4);
+  threadpool11::task_graph graph;
+  std::atomic<int> step{0};
+  int a = -1, b = -1, c = -1, d = -1;
+  auto na = graph.emplace([&]() { a = step++; });
+  auto nb = graph.emplace([&]() { b = step++; });
+  auto nc = graph.emplace([&]() { c = step++; });
+  auto nd = graph.emplace([&]() { d = step++; });
+  na.precede(nb).precede(nc);
+  nd.succeed(nb).succeed(nc);
+
+  for (int run = 0; run < 100; ++run) {
+    step = 0;
+    p.run(graph).get();
+    ASSERT_EQ(0, a);
+    ASSERT_LT(a, b);
+    ASSERT_LT(a, c);
+    ASSERT_EQ(3, d);
+  }
+}
+
+TEST(task_graph, cycle) {
+  pool p;
+  threadpool11::task_graph graph;
+  auto root = graph.emplace([]() {});
+  auto x = graph.emplace([]() {});
+  auto y = graph.emplace([]() {});
+  root.precede(x);
+  x.precede(y);
+  y.precede(x);
+  ASSERT_THROW(p.run(graph), std::invalid_argument);
+}
+
+TEST(pool, post_work_nested) {
+  constexpr size_type outer = 1000;
+  constexpr size_type inner = 100;
+  std::atomic<size_type> counter{0};
+  {
+    pool p;
+    for (size_type i = 0; i < outer; ++i) {
+      p.post_work<void>([&p, &counter]() {
+        for (size_type j = 0; j < inner; ++j) {
+          p.post_work<void>([&counter]() { counter.fetch_add(1, std::memory_order_relaxed); },
+                            pool::no_future_tag);
+        }
+      }, pool::no_future_tag);
+    }
+    while (counter.load() != outer * inner) {
+      std::this_thread::yield();
+    }
+  }
+  ASSERT_EQ(outer * inner, counter.load());
+}
+
+TEST(pool, help_while_waiting) {
+  // with a single worker, waiting for a nested work only finishes if the worker runs it meanwhile
+  pool p(1);
+  auto outer = p.post_work([&p]() { return p.post_work([]() { return 41; }).get() + 1; });
+  ASSERT_EQ(42, outer.get());
+
+  pool q(2);
+  std::function<size_type(size_type)> fib = [&q, &fib](size_type n) -> size_type {
+    if (n < 2) {
+      return n;
+    }
+    auto a = q.post_work([&fib, n]() { return fib(n - 1); });
+    const size_type b = fib(n - 2);
+    return a.get() + b;
+  };
+  ASSERT_EQ(6765u, q.post_work([&fib]() { return fib(20); }).get());
+}
+
+TEST(pool, snapshot) {
+  pool p(2);
+  p.post_n(1000, [](size_type) {}).get();
+  // the last works are counted after they complete the future
+  p.join_all();
+  const auto stats = p.snapshot();
+
+#if defined(threadpool11_STATS)
+  ASSERT_EQ(2u, stats.workers.size());
+  std::uint64_t executed = 0;
+  for (const auto& worker : stats.workers) {
+    executed += worker.tasks_executed;
+  }
+  ASSERT_EQ(1000u, executed);
+  ASSERT_EQ(1000u, stats.queue_latency.count());
+  ASSERT_EQ(1000u, stats.run_time.count());
+  ASSERT_LE(stats.run_time.percentile(0.5), stats.run_time.percentile(1.0));
+#else
+  ASSERT_TRUE(stats.workers.empty());
+#endif
+}
+
+TEST(pool, trace) {
+  pool p(2);
+  ASSERT_EQ(42, p.post_work("answer", []() { return 42; }).get());
+  for (int i = 0; i < 96; ++i) {
+    p.post_work("quoted \"work\"", []() {}, pool::no_future_tag);
+  }
+  // the other posts take a labelled callable
+  threadpool11::cancellation_source source;
+  p.post_work(pool::priority_t::HIGH, threadpool11::labelled("high", []() {})).get();
+  p.post_work(source.token(), threadpool11::labelled("cancellable", []() {})).get();
+  p.post_to(1, threadpool11::labelled("targeted", []() {})).get();
+  p.join_all();
+
+  const auto events = p.trace();
+  std::ostringstream json;
+  p.dump_trace(json);
+  ASSERT_EQ(0u, json.str().find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+
+#if defined(threadpool11_TRACE)
+  ASSERT_EQ(100u, events.size());
+  for (const auto& event : events) {
+    ASSERT_LT(event.worker, 2u);
+    ASSERT_LE(event.enqueue_time, event.start_time);
+    ASSERT_LE(event.start_time, event.end_time);
+  }
+  for (const std::string label : {"answer", "high", "cancellable", "targeted"}) {
+    ASSERT_EQ(1, std::count_if(events.begin(), events.end(), [&label](const threadpool11::trace_event& event) {
+                return event.label != nullptr && label == event.label;
+              }));
+  }
+  ASSERT_NE(std::string::npos, json.str().find("\"name\":\"quoted \\\"work\\\"\",\"cat\":\"work\",\"ph\":\"X\""));
+#else
+  ASSERT_TRUE(events.empty());
+#endif
+}
+
+TEST(latency_histogram, percentile) {
+  threadpool11::latency_histogram histogram;
+  ASSERT_EQ(std::chrono::nanoseconds::zero(), histogram.percentile(0.5));
+  histogram.add(threadpool11::latency_histogram::bucket_of(100), 99);
+  histogram.add(threadpool11::latency_histogram::bucket_of(1000000), 1);
+  ASSERT_EQ(100u, histogram.count());
+  ASSERT_EQ(std::chrono::nanoseconds(128), histogram.percentile(0.5));
+  ASSERT_EQ(std::chrono::nanoseconds(1 << 20), histogram.percentile(1.0));
+}
+
+TEST(algorithm, sort) {
+  pool p(4);
+
+  std::vector<int> values(100000);
+  std::uint32_t rng = 1;
+  for (auto& value : values) {
+    rng = rng * 1664525u + 1013904223u;
+    value = static_cast<int>(rng >> 20);
+  }
+  std::vector<int> expected(values);
+  std::sort(expected.begin(), expected.end(), std::greater<int>());
+
+  threadpool11::parallel_sort(p, values.begin(), values.end(), std::greater<int>(), 256);
+  ASSERT_EQ(expected, values);
+
+  // move only elements
+  std::vector<std::unique_ptr<int>> pointers;
+  for (int i = 0; i < 10000; ++i) {
+    pointers.emplace_back(new int((i * 7919) % 10000));
+  }
+  threadpool11::parallel_sort(p, pointers.begin(), pointers.end(),
+                              [](const std::unique_ptr<int>& a, const std::unique_ptr<int>& b) { return *a < *b; }, 64);
+  for (int i = 0; i < 10000; ++i) {
+    ASSERT_EQ(i, *pointers[i]);
+  }
+}
+
+TEST(algorithm, transform_scan) {
+  pool p(4);
+
+  std::vector<size_type> values(50000);
+  std::iota(values.begin(), values.end(), 0);
+
+  std::vector<size_type> squares(values.size());
+  threadpool11::parallel_transform(p, values.begin(), values.end(), squares.begin(),
+                                   [](size_type i) { return i * i; }, 128);
+  for (size_type i = 0; i < values.size(); ++i) {
+    ASSERT_EQ(i * i, squares[i]);
+  }
+
+  std::vector<size_type> expected(values.size());
+  std::partial_sum(values.begin(), values.end(), expected.begin());
+  threadpool11::parallel_inclusive_scan(p, values.begin(), values.end(), values.begin(), std::plus<size_type>(), 128);
+  ASSERT_EQ(expected, values);
+}
+
+TEST(algorithm, find_count) {
+  pool p(4);
+
+  std::vector<int> values(50000, 0);
+  values[30000] = 1;
+  values[40000] = 1;
+
+  ASSERT_EQ(values.begin() + 30000,
+            threadpool11::parallel_find_if(p, values.begin(), values.end(), [](int v) { return v == 1; }, 128));
+  ASSERT_EQ(values.end(),
+            threadpool11::parallel_find_if(p, values.begin(), values.end(), [](int v) { return v == 2; }, 128));
+  ASSERT_EQ(2, threadpool11::parallel_count_if(p, values.begin(), values.end(), [](int v) { return v == 1; }, 128));
+}
+
+TEST(work_stealing_deque, push_pop_steal) {
+  constexpr size_type count = 10000;
+  threadpool11::work_stealing_deque<size_type*> deque(2);
+  std::vector<size_type> values(count);
+  for (size_type i = 0; i < count; ++i) {
+    deque.push(&values[i]);
+  }
+  ASSERT_EQ(count, deque.size());
+
+  size_type* item;
+  ASSERT_TRUE(deque.steal(item));
+  ASSERT_EQ(&values.front(), item);
+  ASSERT_TRUE(deque.pop(item));
+  ASSERT_EQ(&values.back(), item);
+
+  std::atomic<size_type> stolen{0};
+  std::thread thief([&]() {
+    size_type* i;
+    while (!deque.empty()) {
+      if (deque.steal(i)) {
+        ++*i;
+        stolen.fetch_add(1);
+      }
+    }
+  });
+  size_type popped = 0;
+  while (deque.pop(item)) {
+    ++*item;
+    ++popped;
+  }
+  thief.join();
+
+  ASSERT_EQ(count - 2, popped + stolen.load());
+  for (size_type i = 1; i < count - 1; ++i) {
+    ASSERT_EQ(1u, values[i]);
+  }
+}
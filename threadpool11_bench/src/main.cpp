@@ -0,0 +1,439 @@
+#include "threadpool11/threadpool11.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+/**
+ * Microbenchmarks of threadpool11, see --help.
+ *
+ * Every measurement is taken after a warm-up run and repeated, results are
+ * printed as one record per line of CSV or as a JSON array so that runs of
+ * different releases can be compared by a script.
+ */
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+using size_type = threadpool11::pool::size_type;
+
+struct options {
+  std::string format = "json";
+  std::string filter;
+  size_type max_workers = std::max(1u, std::thread::hardware_concurrency());
+  size_type repetitions = 5;
+  double scale = 1.0;
+};
+
+struct record {
+  std::string benchmark;
+  std::string variant;
+  size_type workers;
+  size_type producers;
+  size_type items;
+  std::string metric;
+  std::string unit;
+  double value;
+};
+
+class reporter {
+public:
+  void add(record r) { records_.push_back(std::move(r)); }
+
+  void print(const std::string& format, std::ostream& out) const {
+    if (format == "csv") {
+      out << "benchmark,variant,workers,producers,items,metric,unit,value\n";
+      for (const auto& r : records_) {
+        out << r.benchmark << ',' << r.variant << ',' << r.workers << ',' << r.producers << ',' << r.items << ','
+            << r.metric << ',' << r.unit << ',' << r.value << '\n';
+      }
+      return;
+    }
+
+    out << "[\n";
+    for (size_type i = 0; i < records_.size(); ++i) {
+      const auto& r = records_[i];
+      out << "  {\"benchmark\": \"" << r.benchmark << "\", \"variant\": \"" << r.variant
+          << "\", \"workers\": " << r.workers << ", \"producers\": " << r.producers << ", \"items\": " << r.items
+          << ", \"metric\": \"" << r.metric << "\", \"unit\": \"" << r.unit << "\", \"value\": " << r.value << '}'
+          << (i + 1 < records_.size() ? ",\n" : "\n");
+    }
+    out << "]\n";
+  }
+
+private:
+  std::vector<record> records_;
+};
+
+double seconds_since(clock_type::time_point begin) {
+  return std::chrono::duration<double>(clock_type::now() - begin).count();
+}
+
+/**
+ * Runs body once to warm up and then repetitions times, body returns the seconds it took.
+ */
+template <class Body>
+std::vector<double> repeat(size_type repetitions, Body body) {
+  body();
+
+  std::vector<double> times;
+  for (size_type i = 0; i < repetitions; ++i) {
+    times.push_back(body());
+  }
+  std::sort(times.begin(), times.end());
+  return times;
+}
+
+/**
+ * Adds the median and best rate of items per second.
+ */
+void add_throughput(reporter& out, const std::string& benchmark, const std::string& variant, size_type workers,
+                    size_type producers, size_type items, const std::vector<double>& times) {
+  const double median = times[times.size() / 2];
+  const double best = times.front();
+  out.add({benchmark, variant, workers, producers, items, "median", "items/s", static_cast<double>(items) / median});
+  out.add({benchmark, variant, workers, producers, items, "best", "items/s", static_cast<double>(items) / best});
+}
+
+void add_percentiles(reporter& out, const std::string& benchmark, const std::string& variant, size_type workers,
+                     std::vector<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  const auto at = [&samples](double p) { return samples[static_cast<size_type>(p * (samples.size() - 1))]; };
+
+  const size_type n = samples.size();
+  out.add({benchmark, variant, workers, 1, n, "p50", "ns", at(0.5)});
+  out.add({benchmark, variant, workers, 1, n, "p90", "ns", at(0.9)});
+  out.add({benchmark, variant, workers, 1, n, "p99", "ns", at(0.99)});
+  out.add({benchmark, variant, workers, 1, n, "p999", "ns", at(0.999)});
+  out.add({benchmark, variant, workers, 1, n, "max", "ns", samples.back()});
+}
+
+void wait_for(const std::atomic<size_type>& counter, size_type value) {
+  while (counter.load(std::memory_order_acquire) != value) {
+    std::this_thread::yield();
+  }
+}
+
+/**
+ * Time from posting a work until it starts running. "hot" posts back to back so the
+ * workers are still spinning, "cold" sleeps in between so that they park.
+ */
+void latency(reporter& out, const options& opt, size_type workers) {
+  const size_type samples = static_cast<size_type>(2000 * opt.scale) + 1;
+
+  for (const bool cold : {false, true}) {
+    threadpool11::pool pool(workers);
+    std::vector<double> results;
+    results.reserve(samples);
+
+    for (size_type i = 0; i < samples; ++i) {
+      if (cold) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      std::atomic<size_type> done{0};
+      clock_type::time_point started;
+      const auto posted = clock_type::now();
+      pool.post_work([&]() {
+        started = clock_type::now();
+        done.store(1, std::memory_order_release);
+      }, threadpool11::pool::no_future_tag);
+      wait_for(done, 1);
+      results.push_back(std::chrono::duration<double, std::nano>(started - posted).count());
+    }
+
+    add_percentiles(out, "latency", cold ? "cold" : "hot", workers, std::move(results));
+  }
+
+  if (workers == opt.max_workers) {
+    std::vector<double> results;
+    for (size_type i = 0; i < samples / 4 + 1; ++i) {
+      clock_type::time_point started;
+      const auto posted = clock_type::now();
+      std::async(std::launch::async, [&started]() { started = clock_type::now(); }).get();
+      results.push_back(std::chrono::duration<double, std::nano>(started - posted).count());
+    }
+    add_percentiles(out, "latency", "std::async", workers, std::move(results));
+  }
+}
+
+/**
+ * Posting and running empty works from one thread.
+ */
+void throughput(reporter& out, const options& opt, size_type workers) {
+  const size_type n = static_cast<size_type>(200000 * opt.scale) + 1;
+  threadpool11::pool pool(workers);
+
+  add_throughput(out, "throughput", "future", workers, 1, n, repeat(opt.repetitions, [&]() {
+    std::vector<threadpool11::future<void>> futures;
+    futures.reserve(n);
+    const auto begin = clock_type::now();
+    for (size_type i = 0; i < n; ++i) {
+      futures.push_back(pool.post_work([]() {}));
+    }
+    for (auto& future : futures) {
+      future.get();
+    }
+    return seconds_since(begin);
+  }));
+
+  add_throughput(out, "throughput", "no_future", workers, 1, n, repeat(opt.repetitions, [&]() {
+    std::atomic<size_type> done{0};
+    const auto begin = clock_type::now();
+    for (size_type i = 0; i < n; ++i) {
+      pool.post_work([&done]() { done.fetch_add(1, std::memory_order_release); }, threadpool11::pool::no_future_tag);
+    }
+    wait_for(done, n);
+    return seconds_since(begin);
+  }));
+}
+
+/**
+ * Rounds of posting a batch of works and waiting for all of them.
+ */
+void fan_out_fan_in(reporter& out, const options& opt, size_type workers) {
+  const size_type width = 64;
+  const size_type rounds = static_cast<size_type>(2000 * opt.scale) + 1;
+  const size_type items = width * rounds;
+  threadpool11::pool pool(workers);
+
+  add_throughput(out, "fan_out_fan_in", "post_n", workers, 1, items, repeat(opt.repetitions, [&]() {
+    std::atomic<size_type> sink{0};
+    const auto begin = clock_type::now();
+    for (size_type r = 0; r < rounds; ++r) {
+      pool.post_n(width, [&sink](size_type i) { sink.fetch_add(i, std::memory_order_relaxed); }).get();
+    }
+    return seconds_since(begin);
+  }));
+
+  add_throughput(out, "fan_out_fan_in", "futures", workers, 1, items, repeat(opt.repetitions, [&]() {
+    std::atomic<size_type> sink{0};
+    std::vector<threadpool11::future<void>> futures;
+    futures.reserve(width);
+    const auto begin = clock_type::now();
+    for (size_type r = 0; r < rounds; ++r) {
+      for (size_type i = 0; i < width; ++i) {
+        futures.push_back(pool.post_work([&sink, i]() { sink.fetch_add(i, std::memory_order_relaxed); }));
+      }
+      for (auto& future : futures) {
+        future.get();
+      }
+      futures.clear();
+    }
+    return seconds_since(begin);
+  }));
+
+#if defined(_OPENMP)
+  add_throughput(out, "fan_out_fan_in", "openmp", workers, 1, items, repeat(opt.repetitions, [&]() {
+    std::atomic<size_type> sink{0};
+    const auto begin = clock_type::now();
+    for (size_type r = 0; r < rounds; ++r) {
+#pragma omp parallel for num_threads(static_cast<int>(workers))
+      for (long i = 0; i < static_cast<long>(width); ++i) {
+        sink.fetch_add(static_cast<size_type>(i), std::memory_order_relaxed);
+      }
+    }
+    return seconds_since(begin);
+  }));
+#endif
+}
+
+size_type pool_fib(threadpool11::pool& pool, size_type n) {
+  if (n < 2) {
+    return n;
+  }
+  auto a = pool.post_work([&pool, n]() { return pool_fib(pool, n - 1); });
+  const size_type b = pool_fib(pool, n - 2);
+  return a.get() + b;
+}
+
+#if defined(_OPENMP)
+size_type omp_fib(size_type n) {
+  if (n < 2) {
+    return n;
+  }
+  size_type a;
+#pragma omp task shared(a)
+  a = omp_fib(n - 1);
+  const size_type b = omp_fib(n - 2);
+#pragma omp taskwait
+  return a + b;
+}
+#endif
+
+size_type fib_calls(size_type n) { return n < 2 ? 1 : 1 + fib_calls(n - 1) + fib_calls(n - 2); }
+
+/**
+ * Recursive spawning, works wait for the works they post.
+ */
+void nested(reporter& out, const options& opt, size_type workers) {
+  const size_type n = opt.scale >= 1.0 ? 22 : 16;
+  const size_type items = fib_calls(n);
+  threadpool11::pool pool(workers);
+
+  add_throughput(out, "nested_fib", "future", workers, 1, items, repeat(opt.repetitions, [&]() {
+    const auto begin = clock_type::now();
+    pool.post_work([&pool, n]() { return pool_fib(pool, n); }).get();
+    return seconds_since(begin);
+  }));
+
+#if defined(_OPENMP)
+  add_throughput(out, "nested_fib", "openmp", workers, 1, items, repeat(opt.repetitions, [&]() {
+    const auto begin = clock_type::now();
+#pragma omp parallel num_threads(static_cast<int>(workers))
+#pragma omp single
+    omp_fib(n);
+    return seconds_since(begin);
+  }));
+#endif
+}
+
+/**
+ * Sorting random integers, std::sort is the baseline.
+ */
+void sort(reporter& out, const options& opt, size_type workers) {
+  const size_type n = static_cast<size_type>(2000000 * opt.scale) + 1;
+  threadpool11::pool pool(workers);
+
+  std::vector<std::uint64_t> input(n);
+  std::uint64_t rng = 88172645463325252u;
+  for (auto& value : input) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    value = rng;
+  }
+
+  std::vector<std::uint64_t> values;
+  add_throughput(out, "sort", "parallel_sort", workers, 1, n, repeat(opt.repetitions, [&]() {
+    values = input;
+    const auto begin = clock_type::now();
+    threadpool11::parallel_sort(pool, values.begin(), values.end());
+    return seconds_since(begin);
+  }));
+
+  add_throughput(out, "sort", "std_sort", workers, 1, n, repeat(opt.repetitions, [&]() {
+    values = input;
+    const auto begin = clock_type::now();
+    std::sort(values.begin(), values.end());
+    return seconds_since(begin);
+  }));
+}
+
+/**
+ * Several threads posting to the same pool at once.
+ */
+void producers(reporter& out, const options& opt) {
+  const size_type n = static_cast<size_type>(200000 * opt.scale) + 1;
+  threadpool11::pool pool(opt.max_workers);
+
+  for (size_type count = 1; count <= 2 * opt.max_workers; count *= 2) {
+    const size_type per_producer = n / count;
+    add_throughput(out, "producers", "no_future", opt.max_workers, count, per_producer * count,
+                   repeat(opt.repetitions, [&]() {
+                     std::atomic<size_type> done{0};
+                     std::vector<std::thread> threads;
+                     const auto begin = clock_type::now();
+                     for (size_type p = 0; p < count; ++p) {
+                       threads.emplace_back([&]() {
+                         for (size_type i = 0; i < per_producer; ++i) {
+                           pool.post_work([&done]() { done.fetch_add(1, std::memory_order_release); },
+                                          threadpool11::pool::no_future_tag);
+                         }
+                       });
+                     }
+                     for (auto& thread : threads) {
+                       thread.join();
+                     }
+                     wait_for(done, per_producer * count);
+                     return seconds_since(begin);
+                   }));
+  }
+}
+
+bool selected(const options& opt, const char* benchmark) {
+  return opt.filter.empty() || opt.filter.find(benchmark) != std::string::npos;
+}
+
+void usage(const char* program) {
+  std::cerr << "usage: " << program << " [options]\n"
+            << "  --format=json|csv    output format, json by default\n"
+            << "  --filter=NAME[,...]  only run the named benchmarks: latency, throughput,\n"
+            << "                       fan_out_fan_in, nested_fib, sort, producers\n"
+            << "  --workers=N          largest worker count of the sweeps, hardware concurrency by default\n"
+            << "  --repetitions=N      measured runs per benchmark after a warm-up run, 5 by default\n"
+            << "  --scale=X            multiplies the amount of work, 1 by default\n";
+}
+
+}
+
+int main(int argc, char* argv[]) {
+  options opt;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const auto value = [&arg]() { return arg.substr(arg.find('=') + 1); };
+
+    if (arg.compare(0, 9, "--format=") == 0) {
+      opt.format = value();
+    } else if (arg.compare(0, 9, "--filter=") == 0) {
+      opt.filter = value();
+    } else if (arg.compare(0, 10, "--workers=") == 0) {
+      opt.max_workers = std::max<size_type>(1, std::strtoul(value().c_str(), nullptr, 10));
+    } else if (arg.compare(0, 14, "--repetitions=") == 0) {
+      opt.repetitions = std::max<size_type>(1, std::strtoul(value().c_str(), nullptr, 10));
+    } else if (arg.compare(0, 8, "--scale=") == 0) {
+      opt.scale = std::max(0.0, std::strtod(value().c_str(), nullptr));
+    } else {
+      usage(argv[0]);
+      return arg == "--help" ? 0 : 1;
+    }
+  }
+
+  if (opt.format != "json" && opt.format != "csv") {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // worker count sweep: 1, 2, 4, ... and the maximum
+  std::vector<size_type> sweep;
+  for (size_type workers = 1; workers < opt.max_workers; workers *= 2) {
+    sweep.push_back(workers);
+  }
+  sweep.push_back(opt.max_workers);
+
+  reporter out;
+  for (const size_type workers : sweep) {
+    if (selected(opt, "latency")) {
+      latency(out, opt, workers);
+    }
+    if (selected(opt, "throughput")) {
+      throughput(out, opt, workers);
+    }
+    if (selected(opt, "fan_out_fan_in")) {
+      fan_out_fan_in(out, opt, workers);
+    }
+    if (selected(opt, "nested_fib")) {
+      nested(out, opt, workers);
+    }
+    if (selected(opt, "sort")) {
+      sort(out, opt, workers);
+    }
+  }
+  if (selected(opt, "producers")) {
+    producers(out, opt);
+  }
+
+  out.print(opt.format, std::cout);
+}
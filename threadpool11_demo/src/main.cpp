@@ -82,7 +82,7 @@ int main(int argc, char* argv[]) {
 
     {
       std::cout << "Executing 5 test1Func() WITH posting to thread pool:" << std::endl;
-      std::vector<std::future<void>> futures;
+      std::vector<threadpool11::future<void>> futures;
       auto begin = std::chrono::high_resolution_clock::now();
       futures.emplace_back(pool.post_work<void>(test1Func));
       futures.emplace_back(pool.post_work<void>(test1Func));
@@ -126,7 +126,7 @@ int main(int argc, char* argv[]) {
     std::cout << "Demo 2" << std::endl;
     std::cout << "Posting 1.000.000 jobs." << std::endl;
 
-    std::vector<std::future<void>> futures;
+    std::vector<threadpool11::future<void>> futures;
     auto begin = std::chrono::high_resolution_clock::now();
     for (int i = 0; i < 1000000; ++i) {
       futures.emplace_back(pool.post_work<void>(test2Func));
@@ -152,7 +152,7 @@ int main(int argc, char* argv[]) {
     std::cout << "Testing work queue flow." << std::endl;
 #define th11_demo_iterations 30000
     // pool.increaseWorkerCountBy(th11_demo_iterations - 2);
-    std::array<std::future<void>, th11_demo_iterations> futures;
+    std::array<threadpool11::future<void>, th11_demo_iterations> futures;
     auto begin = std::chrono::high_resolution_clock::now();
     for (int i = 0; i < th11_demo_iterations; ++i)
       futures[i] = pool.post_work<void>([=]() { test3Func(); });
@@ -172,7 +172,7 @@ int main(int argc, char* argv[]) {
     std::cout << "Demo 4\n";
     std::cout
         << "WARNING: This test's output may be distorted because no synchronization on std::cout is done.\n";
-    std::array<std::future<float>, 20> futures;
+    std::array<threadpool11::future<float>, 20> futures;
 
     auto begin = std::chrono::high_resolution_clock::now();
     for (int i = 0; i < 20; i++) {
@@ -202,7 +202,7 @@ int main(int argc, char* argv[]) {
   {
     pool.set_worker_count(std::thread::hardware_concurrency());
 
-    std::array<std::future<std::size_t>, iter> futures;
+    std::array<threadpool11::future<std::size_t>, iter> futures;
 
     const auto begin = std::chrono::high_resolution_clock::now();
 
@@ -27,7 +27,7 @@ int main(int argc, char* argv[]) {
     std::vector<std::size_t> a;
     a.reserve(iter);
 
-    std::vector<std::future<std::size_t>> futures;
+    std::vector<threadpool11::future<std::size_t>> futures;
     futures.reserve(iter);
 
     const auto begin = std::chrono::high_resolution_clock::now();
@@ -65,6 +65,56 @@ int main(int argc, char* argv[]) {
               << " milliseconds." << std::endl << std::endl;
   }
 
+  {
+    threadpool11::pool pool;
+
+    std::vector<std::size_t> a(iter);
+
+    const auto begin = std::chrono::high_resolution_clock::now();
+
+    threadpool11::task_group group(pool);
+    for (auto i = 0u; i < iter; ++i) {
+      group.run([&a, i]() { a[i] = factorial(i % 100000); });
+    }
+    group.wait();
+
+    const auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "threadpool11 task_group execution took "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
+              << " milliseconds." << std::endl << std::endl;
+  }
+
+  {
+    threadpool11::pool pool;
+
+    std::vector<std::size_t> a(iter);
+
+    const auto begin = std::chrono::high_resolution_clock::now();
+
+    pool.parallel_for(0ul, iter, [&a](std::size_t i) { a[i] = factorial(i % 100000); });
+
+    const auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "threadpool11 parallel_for execution took "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
+              << " milliseconds." << std::endl << std::endl;
+  }
+
+  {
+    threadpool11::pool pool;
+
+    std::vector<std::size_t> a(iter);
+
+    const auto begin = std::chrono::high_resolution_clock::now();
+
+    pool.parallel_for(0ul, iter, [&a](std::size_t i) { a[i] = factorial(i % 100000); },
+                      threadpool11::dynamic_partitioner(1));
+
+    const auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "threadpool11 parallel_for (dynamic partitioner) execution took "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count()
+              << " milliseconds." << std::endl << std::endl;
+  }
+
   {
     std::vector<std::size_t> a;
     a.reserve(iter);